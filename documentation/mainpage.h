@@ -144,6 +144,12 @@ Each element must in turn have "type" as a string.
 
 By convention the nested Config for an element should use the
 enclosing Config as an enclosing scope ( Config::new_scope() ).
+
+Setting the environment variable FLAME_LATTICE_CACHE to a directory name
+enables a cache of parser results ( GLPSParser::setCacheDir() ).
+Repeated parsing of unchanged lattice, curve, and cavity data files,
+and of RF cavity field map tables ( numeric_table_cache ),
+then loads a binary copy instead of re-running the parser.
 */
 
 // =====================================================================================
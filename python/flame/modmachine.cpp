@@ -1,9 +1,17 @@
 #include <climits>
+#include <cstring>
+#include <limits>
 #include <sstream>
+#include <set>
 
 #include "flame/core/base.h"
 #include "pyflame.h"
 
+#define NO_IMPORT_ARRAY
+#define PY_ARRAY_UNIQUE_SYMBOL FLAME_PyArray_API
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/ndarrayobject.h>
+
 
 #define TRY PyMachine *machine = reinterpret_cast<PyMachine*>(raw); try
 
@@ -133,6 +141,209 @@ struct PyStoreObserver : public Observer
     }
 };
 
+// Copies selected parameters (by getArray() index) of each observed State
+// into one contiguous buffer per parameter, instead of keeping copies of whole States.
+struct PyRecordObserver : public Observer
+{
+    typedef StateBase::ArrayInfo ArrayInfo;
+    struct field_t {
+        std::string name;
+        unsigned idx; //!< getArray() index
+        ArrayInfo::Type type;
+        unsigned ndim;
+        //! values of each observation in C order, one after the other
+        std::vector<char> data;
+        //! dimensions of each observation
+        std::vector<size_t> dims;
+    };
+    std::vector<field_t> fields;
+    std::vector<size_t> index; //!< element index of each observation
+    size_t expect; //!< # of observations to reserve space for
+
+    PyRecordObserver() :expect(0) {}
+    virtual ~PyRecordObserver() {}
+
+    static size_t itemsize(ArrayInfo::Type type) {
+        return type==ArrayInfo::Sizet ? sizeof(size_t) : sizeof(double);
+    }
+
+    //! # of elements in an array of shape dim[0, nd)
+    static size_t count(const size_t *dim, unsigned nd)
+    {
+        size_t ret = 1;
+        for(unsigned d=0; d<nd; d++)
+            ret *= dim[d];
+        return ret;
+    }
+
+    //! Step I[0, nd) to the next index of an array of shape dim[0, nd), in C order.
+    //! @returns false after the last index
+    static bool next_index(size_t *I, const size_t *dim, unsigned nd)
+    {
+        while(nd--) {
+            if(++I[nd]<dim[nd])
+                return true;
+            I[nd] = 0;
+        }
+        return false;
+    }
+
+    //! Select the parameter named 'name' of States like S
+    void add(StateBase& S, const char *name)
+    {
+        ArrayInfo info;
+        for(unsigned i=0; S.getArray(i, info); i++) {
+            if(strcmp(info.name, name)!=0)
+                continue;
+            fields.push_back(field_t());
+            field_t& F = fields.back();
+            F.name = name;
+            F.idx = i;
+            F.type = info.type;
+            F.ndim = info.ndim;
+            return;
+        }
+        throw std::invalid_argument(SB()<<"State has no parameter '"<<name<<"'");
+    }
+
+    virtual void view(const ElementVoid* elem, const StateBase* state) override final
+    {
+        // getArray() isn't const, however we only read through the returned pointers
+        StateBase *S = const_cast<StateBase*>(state);
+
+        index.push_back(elem->index);
+
+        for(size_t n=0; n<fields.size(); n++) {
+            field_t& F = fields[n];
+            ArrayInfo info;
+            if(!S->getArray(F.idx, info) || strcmp(info.name, F.name.c_str())!=0
+                    || info.type!=F.type || info.ndim!=F.ndim)
+                throw std::runtime_error(SB()<<"State parameter '"<<F.name<<"' changed at element "<<elem->index);
+
+            // unused dimensions are 1
+            size_t dim[ArrayInfo::maxdims];
+            std::fill(dim, dim+ArrayInfo::maxdims, 1u);
+            std::copy(info.dim, info.dim+info.ndim, dim);
+            F.dims.insert(F.dims.end(), dim, dim+ArrayInfo::maxdims);
+
+            const size_t isize = itemsize(F.type),
+                         N = count(dim, ArrayInfo::maxdims);
+            if(F.data.empty())
+                F.data.reserve(expect*N*isize);
+            size_t offset = F.data.size();
+            F.data.resize(offset + N*isize);
+            if(N==0)
+                continue;
+
+            char *dest = &F.data[offset];
+            size_t I[ArrayInfo::maxdims] = {};
+            do {
+                const char *src = (const char*)info.ptr;
+                for(unsigned d=0; d<info.ndim; d++)
+                    src += I[d]*info.stride[d];
+                memcpy(dest, src, isize);
+                dest += isize;
+            } while(next_index(I, info.dim, info.ndim));
+        }
+    }
+
+    static void free_buffer(PyObject *cap)
+    {
+        delete (std::vector<char>*)PyCapsule_GetPointer(cap, NULL);
+    }
+
+    //! Wrap 'data' as an array with shape [nobs]+dims, taking ownership of the buffer.
+    static PyObject* wrap(std::vector<char>& data, int pytype, unsigned nd, npy_intp *dims)
+    {
+        std::unique_ptr<std::vector<char> > buf(new std::vector<char>());
+        buf->swap(data);
+
+        PyRef<> arr(PyArray_SimpleNewFromData(nd, dims, pytype, buf->empty() ? NULL : &(*buf)[0]));
+        if(buf->empty())
+            return arr.release(); // numpy allocated (empty) storage
+
+        PyRef<> base(PyCapsule_New(buf.get(), NULL, &free_buffer));
+        buf.release();
+        if(PyArray_SetBaseObject((PyArrayObject*)arr.py(), base.release())) // steals reference
+            throw std::runtime_error(""); // a py exception is active
+        return arr.release();
+    }
+
+    //! Build an array for one field with shape [nobs]+dims.
+    //! Where the dimensions of observations differ (eg. the # of charge states)
+    //! each is padded with NaN (or zero for integers) to the largest.
+    static PyObject* field2array(field_t& F)
+    {
+        enum {M=ArrayInfo::maxdims};
+        const size_t nobs = F.dims.size()/M;
+        const size_t isize = itemsize(F.type);
+        const int pytype = F.type==ArrayInfo::Sizet ? NPY_SIZE_T : NPY_DOUBLE;
+
+        size_t maxdim[M];
+        std::fill(maxdim, maxdim+M, 0u);
+        bool uniform = true;
+        for(size_t n=0; n<nobs; n++) {
+            for(unsigned d=0; d<M; d++) {
+                size_t dim = F.dims[n*M+d];
+                uniform &= n==0 || dim==maxdim[d];
+                maxdim[d] = std::max(maxdim[d], dim);
+            }
+        }
+
+        npy_intp dims[1+M];
+        dims[0] = nobs;
+        for(unsigned d=0; d<F.ndim; d++)
+            dims[1+d] = nobs ? maxdim[d] : 0;
+
+        if(uniform)
+            return wrap(F.data, pytype, 1+F.ndim, dims);
+
+        const size_t osize = count(maxdim, M);
+        std::vector<char> padded(nobs*osize*isize);
+        if(F.type==ArrayInfo::Double)
+            std::fill((double*)&padded[0], (double*)&padded[0]+nobs*osize, std::numeric_limits<double>::quiet_NaN());
+
+        // copy each row (along the last dimension) of each observation
+        const char *src = F.data.empty() ? NULL : &F.data[0];
+        for(size_t n=0; n<nobs; n++) {
+            const size_t *dim = &F.dims[n*M];
+            if(count(dim, M)==0)
+                continue;
+            char *dest = &padded[n*osize*isize];
+            size_t I[M] = {};
+            do {
+                size_t row = 0;
+                for(unsigned d=0; d<M-1; d++)
+                    row = row*maxdim[d] + I[d];
+                memcpy(dest + row*maxdim[M-1]*isize, src, dim[M-1]*isize);
+                src += dim[M-1]*isize;
+            } while(next_index(I, dim, M-1));
+        }
+        return wrap(padded, pytype, 1+F.ndim, dims);
+    }
+
+    //! {'index':array, name:array, ...}
+    PyObject* result()
+    {
+        PyRef<> ret(PyDict_New());
+
+        npy_intp nobs = index.size();
+        std::vector<char> idx(nobs*sizeof(size_t));
+        if(nobs)
+            memcpy(&idx[0], &index[0], idx.size());
+        PyRef<> pyidx(wrap(idx, NPY_SIZE_T, 1, &nobs));
+        if(PyDict_SetItemString(ret.py(), "index", pyidx.py()))
+            throw std::runtime_error(""); // a py exception is active
+
+        for(size_t n=0; n<fields.size(); n++) {
+            PyRef<> arr(field2array(fields[n]));
+            if(PyDict_SetItemString(ret.py(), fields[n].name.c_str(), arr.py()))
+                throw std::runtime_error("");
+        }
+        return ret.release();
+    }
+};
+
 struct PyScopedObserver
 {
     Machine *machine;
@@ -157,18 +368,37 @@ PyObject *PyMachine_propagate(PyObject *raw, PyObject *args, PyObject *kws)
 {
 
     TRY {
-        PyObject *state, *toobserv = Py_None, *pymax = Py_None;
+        PyObject *state, *toobserv = Py_None, *pymax = Py_None, *torecord = Py_None;
         unsigned long start = 0;
         int max = INT_MAX;
-        const char *pnames[] = {"state", "start", "max", "observe", NULL};
-        if(!PyArg_ParseTupleAndKeywords(args, kws, "O|kOO", (char**)pnames, &state, &start, &pymax, &toobserv))
+        const char *pnames[] = {"state", "start", "max", "observe", "record", NULL};
+        if(!PyArg_ParseTupleAndKeywords(args, kws, "O|kOOO", (char**)pnames, &state, &start, &pymax, &toobserv, &torecord))
             return NULL;
 
         if (pymax!=Py_None) max = (int) PyLong_AsLong(pymax);
 
-        PyStoreObserver observer;
+        StateBase *S = unwrapstate(state);
+
+        PyStoreObserver storer;
+        PyRecordObserver recorder;
+        Observer *observer = &storer;
         PyScopedObserver observing(machine->machine);
 
+        if(torecord!=Py_None) {
+            if(toobserv==Py_None)
+                return PyErr_Format(PyExc_ValueError, "record= requires observe=");
+
+            PyRef<> iter(PyObject_GetIter(torecord)), item;
+            PyCString name;
+
+            while(item.reset(PyIter_Next(iter.py()), PyRef<>::allow_null())) {
+                recorder.add(*S, name.c_str(item.py()));
+            }
+            if(PyErr_Occurred())
+                throw std::runtime_error(""); // caller will get active python exception
+            observer = &recorder;
+        }
+
         if(toobserv!=Py_None) {
             PyRef<> iter(PyObject_GetIter(toobserv)), item;
 
@@ -176,14 +406,17 @@ PyObject *PyMachine_propagate(PyObject *raw, PyObject *args, PyObject *kws)
                 Py_ssize_t num = PyNumber_AsSsize_t(item.py(), PyExc_ValueError);
                 if(PyErr_Occurred())
                     throw std::runtime_error(""); // caller will get active python exception
-                observing.observe(num, &observer);
+                observing.observe(num, observer);
 
             }
         }
 
-        machine->machine->propagate(unwrapstate(state), start, max);
-        if(toobserv) {
-            return observer.list.release();
+        recorder.expect = observing.observed.size();
+        machine->machine->propagate(S, start, max);
+        if(torecord!=Py_None) {
+            return recorder.result();
+        } else if(toobserv) {
+            return storer.list.release();
         } else {
             Py_RETURN_NONE;
         }
@@ -191,6 +424,194 @@ PyObject *PyMachine_propagate(PyObject *raw, PyObject *args, PyObject *kws)
     CATCH()
 }
 
+// Release the GIL while in scope
+struct PyUnlock
+{
+    PyThreadState *save;
+    PyUnlock() :save(PyEval_SaveThread()) {}
+    ~PyUnlock() { PyEval_RestoreThread(save); }
+};
+
+static
+PyObject *PyMachine_propagate_many(PyObject *raw, PyObject *args, PyObject *kws)
+{
+
+    TRY {
+        PyObject *states, *toobserv = Py_None, *pymax = Py_None, *confs = Py_None;
+        unsigned long start = 0;
+        unsigned nthreads = 0;
+        int max = INT_MAX;
+        const char *pnames[] = {"states", "start", "max", "observe", "config", "nthreads", NULL};
+        if(!PyArg_ParseTupleAndKeywords(args, kws, "O|kOOOI", (char**)pnames, &states, &start, &pymax, &toobserv, &confs, &nthreads))
+            return NULL;
+
+        if (pymax!=Py_None) max = (int) PyLong_AsLong(pymax);
+
+        // hold references to the States while the GIL is released
+        std::vector<PyRef<> > pystates;
+        std::vector<Machine::BatchJob> jobs;
+        std::set<StateBase*> unique;
+        {
+            PyRef<> iter(PyObject_GetIter(states)), item;
+
+            while(item.reset(PyIter_Next(iter.py()), PyRef<>::allow_null())) {
+                StateBase *S = unwrapstate(item.py());
+                if(!unique.insert(S).second)
+                    return PyErr_Format(PyExc_ValueError, "The same State may not be propagated more than once");
+                pystates.push_back(item);
+                jobs.push_back(Machine::BatchJob());
+                jobs.back().state = S;
+            }
+            if(PyErr_Occurred())
+                throw std::runtime_error(""); // caller will get active python exception
+        }
+
+        if(toobserv!=Py_None) {
+            std::vector<size_t> observe;
+            PyRef<> iter(PyObject_GetIter(toobserv)), item;
+
+            while(item.reset(PyIter_Next(iter.py()), PyRef<>::allow_null())) {
+                Py_ssize_t num = PyNumber_AsSsize_t(item.py(), PyExc_ValueError);
+                if(PyErr_Occurred())
+                    throw std::runtime_error(""); // caller will get active python exception
+                if(num<0 || (size_t)num>=machine->machine->size())
+                    return PyErr_Format(PyExc_ValueError, "element index out of range");
+                observe.push_back(num);
+            }
+
+            for(size_t i=0; i<jobs.size(); i++)
+                jobs[i].observe = observe;
+        }
+
+        if(confs!=Py_None) {
+            // [{index:{'variable':int|str}, ...}|None, ...]
+            if(!PySequence_Check(confs) || (size_t)PySequence_Size(confs)!=jobs.size())
+                return PyErr_Format(PyExc_ValueError, "config must be a list with one entry for each State");
+
+            for(size_t i=0; i<jobs.size(); i++) {
+                PyRef<> over(PySequence_GetItem(confs, i));
+                if(over.py()==Py_None)
+                    continue;
+                else if(!PyDict_Check(over.py()))
+                    return PyErr_Format(PyExc_ValueError, "config entries must be None or {index:{}}");
+
+                PyObject *key, *value;
+                Py_ssize_t pos = 0;
+                while(PyDict_Next(over.py(), &pos, &key, &value)) {
+                    Py_ssize_t idx = PyNumber_AsSsize_t(key, PyExc_ValueError);
+                    if(PyErr_Occurred())
+                        throw std::runtime_error(""); // caller will get active python exception
+                    if(idx<0 || (size_t)idx>=machine->machine->size())
+                        return PyErr_Format(PyExc_ValueError, "invalid element index %ld", (long)idx);
+                    if(!PyDict_Check(value))
+                        return PyErr_Format(PyExc_ValueError, "element config must be a dict");
+
+                    Config newconf((*machine->machine)[idx]->conf());
+                    PyRef<> list(PyMapping_Items(value));
+                    List2Config(newconf, list.py(), 3); // set depth=3 to prevent recursion
+
+                    jobs[i].overrides.push_back(std::make_pair((size_t)idx, newconf));
+                }
+            }
+        }
+
+        {
+            PyUnlock U;
+            machine->machine->propagate_batch(jobs, start, max, nthreads);
+        }
+
+        for(size_t i=0; i<jobs.size(); i++) {
+            if(!jobs[i].error.empty())
+                return PyErr_Format(PyExc_RuntimeError, "State %lu : %s", (unsigned long)i, jobs[i].error.c_str());
+        }
+
+        if(toobserv==Py_None)
+            Py_RETURN_NONE;
+
+        PyRef<> ret(PyList_New(jobs.size()));
+        for(size_t i=0; i<jobs.size(); i++) {
+            Machine::BatchJob& job = jobs[i];
+            PyRef<> list(PyList_New(job.observed.size()));
+
+            for(size_t j=0; j<job.observed.size(); j++) {
+                PyRef<> tuple(PyTuple_New(2));
+                PyRef<> statecopy(wrapstate(job.observed[j].second.get()));
+                job.observed[j].second.release();
+
+                PyTuple_SET_ITEM(tuple.py(), 0, PyInt_FromSize_t(job.observed[j].first));
+                PyTuple_SET_ITEM(tuple.py(), 1, statecopy.release());
+                PyList_SET_ITEM(list.py(), j, tuple.release());
+            }
+            PyList_SET_ITEM(ret.py(), i, list.release());
+        }
+        return ret.release();
+    } CATCH2(std::invalid_argument, ValueError)
+    CATCH()
+}
+
+static
+PyObject *PyMachine_set_checkpoints(PyObject *raw, PyObject *args, PyObject *kws)
+{
+    TRY {
+        PyObject *indices;
+        const char *pnames[] = {"indices", NULL};
+        if(!PyArg_ParseTupleAndKeywords(args, kws, "O", (char**)pnames, &indices))
+            return NULL;
+
+        std::vector<size_t> idx;
+        PyRef<> iter(PyObject_GetIter(indices)), item;
+
+        while(item.reset(PyIter_Next(iter.py()), PyRef<>::allow_null())) {
+            Py_ssize_t num = PyNumber_AsSsize_t(item.py(), PyExc_ValueError);
+            if(PyErr_Occurred())
+                throw std::runtime_error(""); // caller will get active python exception
+            else if(num<0 || size_t(num)>=machine->machine->size())
+                return PyErr_Format(PyExc_ValueError, "invalid element index %ld", (long)num);
+            idx.push_back(num);
+        }
+        if(PyErr_Occurred())
+            throw std::runtime_error("");
+
+        machine->machine->set_checkpoints(idx);
+
+        Py_RETURN_NONE;
+    } CATCH2(std::invalid_argument, ValueError)
+    CATCH()
+}
+
+static
+PyObject *PyMachine_propagate_incremental(PyObject *raw, PyObject *args, PyObject *kws)
+{
+    TRY {
+        PyObject *state, *pymax = Py_None;
+        int max = INT_MAX;
+        const char *pnames[] = {"state", "max", NULL};
+        if(!PyArg_ParseTupleAndKeywords(args, kws, "O|O", (char**)pnames, &state, &pymax))
+            return NULL;
+
+        if (pymax!=Py_None) max = (int) PyLong_AsLong(pymax);
+
+        size_t resume = machine->machine->propagate_incremental(unwrapstate(state), max);
+
+        return PyInt_FromLong(resume);
+    } CATCH2(std::invalid_argument, ValueError)
+    CATCH()
+}
+
+static
+PyObject *PyMachine_compile(PyObject *raw, PyObject *args, PyObject *kws)
+{
+    TRY {
+        const char *pnames[] = {NULL};
+        if(!PyArg_ParseTupleAndKeywords(args, kws, "", (char**)pnames))
+            return NULL;
+
+        machine->machine->compile();
+
+        Py_RETURN_NONE;
+    } CATCH()
+}
+
 static
 PyObject *PyMachine_reconfigure(PyObject *raw, PyObject *args, PyObject *kws)
 {
@@ -279,13 +700,51 @@ static PyMethodDef PyMachine_methods[] = {
     {"propagate", TOPYCF(&PyMachine_propagate), METH_VARARGS|METH_KEYWORDS,
      "propagate(State, start=0, max=INT_MAX, observe=None)\n"
      "propagate(State, start=0, max=INT_MAX, observe=[1,4,...]) -> [(index,State), ...]\n"
+     "propagate(State, start=0, max=INT_MAX, observe=[1,4,...], record=['moment0_env', ...]) -> {'index':array, 'moment0_env':array, ...}\n"
      "Propagate the provided State through the simulation.\n"
      "\n"
      "start and max selects through which element the State will be passed.\n"
      "\n"
      "observe may be None or an iterable yielding element indicies.\n"
-     "In the second form propagate() returns a list of tuples with the output State of the selected elements."
+     "In the second form propagate() returns a list of tuples with the output State of the selected elements.\n"
+     "\n"
+     "record may be None or an iterable yielding State parameter names, and requires observe.\n"
+     "In the third form only these parameters of the output States of the selected elements are copied.\n"
+     "A dict is returned with an array for each name, with one row for each observation (eg. the shape\n"
+     "of 'moment1' is [nobs, 7, 7, ncharge]), and an array 'index' of element indicies.\n"
+     "Where the shape of a parameter changes (eg. at a stripper) rows are padded with NaN."
+    },
+    {"propagate_many", TOPYCF(&PyMachine_propagate_many), METH_VARARGS|METH_KEYWORDS,
+     "propagate_many([State, ...], start=0, max=INT_MAX, observe=None, config=None, nthreads=0)\n"
+     "propagate_many([State, ...], start=0, max=INT_MAX, observe=[1,4,...]) -> [[(index,State), ...], ...]\n"
+     "Propagate several independent States through the simulation, in parallel.\n"
+     "\n"
+     "Each State is updated as by propagate().  start, max and observe are as for propagate(),\n"
+     "and apply to every State.\n"
+     "In the second form a list of the observed output States is returned for each input State.\n"
+     "\n"
+     "config may be None, or a list with one entry for each State.  Each entry is None,\n"
+     "or a dict {index:{'variable':int|str}} of element config changes, as for reconfigure(),\n"
+     "to be used for the propagation of this State only.\n"
+     "\n"
+     "nthreads limits the number of worker threads.  The default, 0, uses one per CPU.\n"
+     "The Machine must not be modified by other threads during this call."
     },
+    {"set_checkpoints", TOPYCF(&PyMachine_set_checkpoints), METH_VARARGS|METH_KEYWORDS,
+     "set_checkpoints([index, ...])\n"
+     "Select the elements before which propagate_incremental() saves a copy of the State."},
+    {"propagate_incremental", TOPYCF(&PyMachine_propagate_incremental), METH_VARARGS|METH_KEYWORDS,
+     "propagate_incremental(State, max=INT_MAX) -> int\n"
+     "As propagate(State, 0, max), resuming from a saved State where possible.\n"
+     "\n"
+     "A copy of the State is saved before each element selected by set_checkpoints().\n"
+     "When called again with the same initial State, propagation resumes from the last\n"
+     "saved State before the first element changed by reconfigure() since it was saved.\n"
+     "Returns the index of the element from which propagation resumed, or 0."},
+    {"compile", TOPYCF(&PyMachine_compile), METH_VARARGS|METH_KEYWORDS,
+     "compile()\n"
+     "Pre-compute how propagate() groups elements, for a Machine which is propagated many times.\n"
+     "Kept up to date by reconfigure()."},
     {"reconfigure", TOPYCF(&PyMachine_reconfigure), METH_VARARGS|METH_KEYWORDS,
      "reconfigure(index, {'variable':int|str})\n"
      "Change the configuration of an element."},
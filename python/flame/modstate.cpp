@@ -10,14 +10,6 @@
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 #include <numpy/ndarrayobject.h>
 
-#if SIZE_MAX==NPY_MAX_UINT32
-#define NPY_SIZE_T NPY_UINT32
-#elif SIZE_MAX==NPY_MAX_UINT64
-#define NPY_SIZE_T NPY_UINT64
-#else
-#error logic error with SIZE_MAX
-#endif
-
 #define TRY PyState *state = (PyState*)raw; try
 
 namespace {
@@ -181,7 +173,10 @@ int PyState_setattro(PyObject *raw, PyObject *attr, PyObject *val)
                 PyErr_Format(PyExc_TypeError, "unsupported type code %d", info.type);
             }
 
-            return PyErr_Occurred() ? -1 : 0;
+            if(PyErr_Occurred())
+                return -1;
+            state->state->arrayChanged(i);
+            return 0;
         }
         // array (use numpy)
 
@@ -254,6 +249,7 @@ int PyState_setattro(PyObject *raw, PyObject *attr, PyObject *val)
             }
         }
 
+        state->state->arrayChanged(i);
         return 0;
     } CATCH3(std::exception, RuntimeError, -1)
 }
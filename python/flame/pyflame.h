@@ -4,6 +4,16 @@
 #define PYFLAME_H
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <stdint.h>
+
+//! numpy type code for size_t.  Only to be used after numpy/ndarrayobject.h is included.
+#if SIZE_MAX==0xffffffffu
+#define NPY_SIZE_T NPY_UINT32
+#elif SIZE_MAX==0xffffffffffffffffu
+#define NPY_SIZE_T NPY_UINT64
+#else
+#error logic error with SIZE_MAX
+#endif
 
 struct Config;
 struct StateBase;
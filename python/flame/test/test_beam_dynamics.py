@@ -103,6 +103,14 @@ class MomentTest(object):
             else:
                 self.assertAlmostEqual(v, getattr(actual, k), places=decimal, msg="%s %s doesn't match"%(msg or "",k))
 
+    def assertEnvClose(self, expect, actual):
+        '''Assert that two moment1_env are equal to within rounding errors
+
+        Repeated propagation may combine the transfer matrices of several elements,
+        which changes the order of rounding.  RF cavities amplify such differences.
+        '''
+        NT.assert_allclose(actual, expect, rtol=0, atol=1e-7*abs(expect).max())
+
     def checkPropagate(self, elem, instate, outstate, max=1):
         '''Pass given input state through the named element
 
@@ -283,6 +291,27 @@ class TestToStrl(unittest.TestCase, MomentTest):
             'phis':asfarray([2.2741352002135365e+01, 2.2719000451428272e+01]),
         }, max=4)
 
+    def test_rfcav_41_ttftable(self):
+        "Outside of the fitted range, tabulated transit time factors match the field map integration"
+        # ls1_ca01_cav1_d1127  cavtype = "0.041QWR"
+        self.assertEqual(self.M.find(name='ls1_ca01_cav1_d1127')[0], 3)
+        # beta ~= 0.09 is above the fitted range
+        self.M.reconfigure(0, {'IonEk':4.0e6})
+        self.ICM.reconfigure(0, {'IonEk':4.0e6})
+        self.ICM.reconfigure(3, {'forcettfcalc':1.0})
+
+        S1 = self.M.allocState({}, inherit=False)
+        S2 = self.ICM.allocState({}, inherit=False)
+        self.M.propagate(state=S1, max=4)
+        self.ICM.propagate(state=S2, max=4)
+        self.assertConsistent(S1)
+
+        self.assertGreater(S1.ref_beta, 0.08)
+        self.assertAlmostEqual(S1.ref_IonEk/S2.ref_IonEk, 1.0, places=9)
+        self.assertAlmostEqual(S1.ref_phis, S2.ref_phis, places=8)
+        assert_aequal(S1.IonEk/S2.IonEk, [1.0, 1.0], decimal=9)
+        NT.assert_allclose(S1.moment1_env, S2.moment1_env, rtol=0, atol=1e-8*abs(S2.moment1_env).max())
+
     def test_rfcav_41_flagsync(self):
         # ls1_ca01_cav1_d1127  cavtype = "0.041QWR"
         self.assertEqual(self.M.find(name='ls1_ca01_cav1_d1127')[0], 3)
@@ -874,6 +903,184 @@ class TestLS1(unittest.TestCase, MomentTest):
             ]),
         }, max=None)
 
+    def test_propagate_many(self):
+        "Parallel propagation matches serial propagation, including per-state config changes"
+        # ls1_ca01_cav1_d1127  cavtype = "0.041QWR"
+        cav = self.M.find(name='ls1_ca01_cav1_d1127')[0]
+        phi = self.M.conf(cav)['phi']
+        last = len(self.M)-1
+
+        phases = [phi, phi+10.0, phi-10.0, phi+20.0]
+        states = [self.M.allocState({}, inherit=False) for _ in phases]
+        obs = self.M.propagate_many(states, observe=[cav, last], nthreads=2,
+                                    config=[None]+[{cav:{'phi':P}} for P in phases[1:]])
+
+        # the Machine itself is not changed by config=
+        self.assertEqual(self.M.conf(cav)['phi'], phi)
+        S = self.M.allocState({}, inherit=False)
+        self.M.propagate(S)
+        self.assertEnvClose(S.moment1_env, states[0].moment1_env)
+
+        self.assertEqual(len(obs), len(phases))
+        for P, S, O in zip(phases, states, obs):
+            self.M.reconfigure(cav, {'phi':P})
+            E = self.M.allocState({}, inherit=False)
+            self.M.propagate(E)
+
+            self.assertEqual([i for i, _ in O], [cav, last])
+            self.assertEnvClose(E.moment1_env, S.moment1_env)
+            self.assertEnvClose(E.moment1_env, O[1][1].moment1_env)
+            self.assertEqual(S.ref_phis, E.ref_phis)
+
+        self.assertRaises(ValueError, self.M.propagate_many, [states[0], states[0]])
+
+    def test_propagate_record(self):
+        "record= gives the same values as observe= alone, as arrays"
+        last = len(self.M)-1
+        elems = [0, 10, last]
+
+        S = self.M.allocState({}, inherit=False)
+        obs = self.M.propagate(S, observe=elems)
+
+        S = self.M.allocState({}, inherit=False)
+        rec = self.M.propagate(S, observe=elems, record=['moment0_env', 'moment1', 'ref_IonEk'])
+
+        NT.assert_equal(rec['index'], elems)
+        self.assertEqual(rec['moment0_env'].shape, (3, 7))
+        self.assertEqual(rec['moment1'].shape[:3], (3, 7, 7))
+        self.assertEqual(rec['ref_IonEk'].shape, (3,))
+        # the stripper changes the # of charge states, so moment1 is padded
+        self.assertEqual(rec['moment1'].shape[3], max(O.moment1.shape[2] for _i, O in obs))
+        for n, (i, O) in enumerate(obs):
+            nchg = O.moment1.shape[2]
+            NT.assert_equal(rec['moment0_env'][n], O.moment0_env)
+            NT.assert_equal(rec['moment1'][n][..., :nchg], O.moment1)
+            self.assertTrue(numpy.isnan(rec['moment1'][n][..., nchg:]).all())
+            self.assertEqual(rec['ref_IonEk'][n], O.ref_IonEk)
+
+        S = self.M.allocState({}, inherit=False)
+        self.assertRaises(ValueError, self.M.propagate, S, observe=elems, record=['nonexistent'])
+        self.assertRaises(ValueError, self.M.propagate, S, record=['moment0_env'])
+
+    def test_propagate_incremental(self):
+        "Resuming from a checkpoint after reconfigure() matches a full propagation"
+        cav = self.M.find(name='ls1_ca01_cav1_d1127')[0]
+        quad = self.M.find(type='quadrupole')[-1]
+        last = len(self.M)-1
+        self.M.set_checkpoints([cav, quad])
+
+        S = self.M.allocState({}, inherit=False)
+        self.assertEqual(self.M.propagate_incremental(S), 0)
+
+        E = self.M.allocState({}, inherit=False)
+        self.M.propagate(E)
+        assert_aequal(S.moment1_env, E.moment1_env, decimal=12)
+
+        B2 = self.M.conf(quad)['B2']
+        self.M.reconfigure(quad, {'B2':B2*1.1})
+
+        S = self.M.allocState({}, inherit=False)
+        self.assertEqual(self.M.propagate_incremental(S), quad)
+
+        E = self.M.allocState({}, inherit=False)
+        self.M.propagate(E)
+        self.assertAlmostEqual(S.pos, E.pos, places=9)
+        self.assertEqual(S.ref_phis, E.ref_phis)
+        self.assertEnvClose(E.moment1_env, S.moment1_env)
+
+        phi = self.M.conf(cav)['phi']
+        self.M.reconfigure(cav, {'phi':phi+10.0})
+
+        S = self.M.allocState({}, inherit=False)
+        self.assertEqual(self.M.propagate_incremental(S), cav)
+
+        E = self.M.allocState({}, inherit=False)
+        self.M.propagate(E)
+        self.assertEnvClose(E.moment1_env, S.moment1_env)
+
+        # a different initial State can't use saved States
+        S = self.M.allocState({'IonEk':self.M.conf()['IonEk']*1.01}, inherit=False)
+        self.assertEqual(self.M.propagate_incremental(S, max=last), 0)
+
+    def test_rfcav_recall(self):
+        "Alternating input States re-use earlier RF cavity results, which match re-computation"
+        E0 = self.M.conf(0)['IonEk']
+        for E in [E0, E0*1.01, E0, E0*1.01, E0*1.02, E0]:
+            self.M.reconfigure(0, {'IonEk':E})
+            self.ICM.reconfigure(0, {'IonEk':E})
+            S = self.M.allocState({}, inherit=False)
+            R = self.ICM.allocState({}, inherit=False)
+            self.M.propagate(S)
+            self.ICM.propagate(R)
+
+            self.assertEqual(S.ref_IonEk, R.ref_IonEk)
+            self.assertEqual(S.ref_phis, R.ref_phis)
+            NT.assert_array_equal(S.IonEk, R.IonEk)
+            NT.assert_array_equal(S.moment0, R.moment0)
+            self.assertEnvClose(R.moment1_env, S.moment1_env)
+
+    def test_set_particles(self):
+        "Assigning State attributes between propagate() calls is seen by element caches"
+        cav = self.M.find(name='ls1_ca01_cav1_d1127')[0]
+        S = self.M.allocState({}, inherit=False)
+        self.M.propagate(S)
+
+        S = self.M.allocState({}, inherit=False)
+        R = self.ICM.allocState({}, inherit=False)
+        self.M.propagate(S, max=cav)
+        self.ICM.propagate(R, max=cav)
+
+        S.ref_IonEk = R.ref_IonEk = R.ref_IonEk+1e3
+        S.IonEk = R.IonEk = R.IonEk+1e3
+        self.M.propagate(S, start=cav)
+        self.ICM.propagate(R, start=cav)
+
+        self.assertEqual(S.ref_IonEk, R.ref_IonEk)
+        self.assertEqual(S.ref_phis, R.ref_phis)
+        NT.assert_array_equal(S.IonEk, R.IonEk)
+        self.assertEnvClose(R.moment1_env, S.moment1_env)
+
+    def test_repeat_propagate(self):
+        "Repeated propagation, which re-uses combined transfer matrices, matches the first"
+        S1 = self.M.allocState({}, inherit=False)
+        self.M.propagate(S1)
+        for i in range(3):
+            S = self.M.allocState({}, inherit=False)
+            self.M.propagate(S)
+
+            self.assertAlmostEqual(S.pos, S1.pos, places=9)
+            self.assertEqual(S.ref_phis, S1.ref_phis)
+            self.assertEnvClose(S1.moment1_env, S.moment1_env)
+
+        # changing an element discards combined matrices which include it
+        quad = self.M.find(type='quadrupole')[-1]
+        B2 = self.M.conf(quad)['B2']
+        self.M.reconfigure(quad, {'B2':B2*1.1})
+        S = self.M.allocState({}, inherit=False)
+        self.M.propagate(S)
+        self.assertFalse(numpy.allclose(S.moment1_env, S1.moment1_env))
+
+        self.M.reconfigure(quad, {'B2':B2})
+        S = self.M.allocState({}, inherit=False)
+        self.M.propagate(S)
+        self.assertEnvClose(S1.moment1_env, S.moment1_env)
+
+    def test_compile(self):
+        "Propagation with a compiled Machine matches, also after reconfigure() changes the runs of elements"
+        self.M.compile()
+        quad = self.M.find(type='quadrupole')[-1]
+        for conf in [{}, {'skipcache':1.0}, {'skipcache':0.0}]:
+            if conf:
+                self.M.reconfigure(quad, conf)
+            S = self.M.allocState({}, inherit=False)
+            R = self.ICM.allocState({}, inherit=False)
+            self.M.propagate(S)
+            self.ICM.propagate(R)
+
+            self.assertAlmostEqual(S.pos, R.pos, places=9)
+            self.assertEqual(S.ref_phis, R.ref_phis)
+            self.assertEnvClose(R.moment1_env, S.moment1_env)
+
 
 class TestFE(unittest.TestCase, MomentTest):
     """Strategy is to test the state after the first instance of each element type.
@@ -1,8 +1,11 @@
 
 #include <list>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "flame/core/base.h"
 #include "flame/core/util.h"
@@ -11,6 +14,64 @@ namespace {
 // This mutex guards the global Machine::p_state_infos
 typedef boost::mutex info_mutex_t;
 info_mutex_t info_mutex;
+
+// This mutex guards next_cacheid
+info_mutex_t cacheid_mutex;
+size_t next_cacheid = 1; // zero is never used
+
+size_t alloc_cacheid()
+{
+    info_mutex_t::scoped_lock G(cacheid_mutex);
+    return next_cacheid++;
+}
+
+// compare all parameters of two States, as exposed through getArray()
+bool same_state(StateBase& A, StateBase& B)
+{
+    StateBase::ArrayInfo IA, IB;
+    unsigned idx;
+    for(idx=0; A.getArray(idx, IA); idx++) {
+        if(!B.getArray(idx, IB) || strcmp(IA.name, IB.name)!=0
+                || IA.type!=IB.type || IA.ndim!=IB.ndim)
+            return false;
+
+        const size_t esize = IA.type==StateBase::ArrayInfo::Double ? sizeof(double) : sizeof(size_t);
+
+        if(IA.ndim==0) {
+            if(memcmp(IA.ptr, IB.ptr, esize)!=0)
+                return false;
+            continue;
+        }
+
+        size_t total = 1;
+        for(unsigned d=0; d<IA.ndim; d++) {
+            if(IA.dim[d]!=IB.dim[d])
+                return false;
+            total *= IA.dim[d];
+        }
+
+        size_t I[StateBase::ArrayInfo::maxdims] = {0,};
+        for(size_t n=0; n<total; n++) {
+            if(memcmp(IA.raw(I), IB.raw(I), esize)!=0)
+                return false;
+            // increment index, last dimension fastest
+            for(unsigned d=IA.ndim; d>0; d--) {
+                if(++I[d-1]<IA.dim[d-1])
+                    break;
+                I[d-1] = 0;
+            }
+        }
+    }
+    return !B.getArray(idx, IB);
+}
+
+// set StateBase::ctx for the duration of a propagate()
+struct ctx_guard {
+    StateBase *S;
+    ExecContext *prev;
+    ctx_guard(StateBase *S, ExecContext *ctx) :S(S), prev(S->ctx) { S->ctx = ctx; }
+    ~ctx_guard() { S->ctx = prev; }
+};
 }
 
 StateBase::~StateBase() {}
@@ -19,6 +80,7 @@ StateBase::StateBase(const Config& c)
     :next_elem(0)
     ,pos(0e0)
     ,retreat(false)
+    ,ctx(NULL)
     ,pyptr(0)
 {}
 
@@ -26,6 +88,7 @@ StateBase::StateBase(const StateBase& o, clone_tag)
     :next_elem(0)
     ,pos(o.pos)
     ,retreat(false)
+    ,ctx(NULL)
     ,pyptr(0)
 {}
 
@@ -59,6 +122,7 @@ ElementVoid::ElementVoid(const Config& conf)
     ,length(conf.get<double>("L",0.0))
     ,p_observe(NULL)
     ,p_conf(conf)
+    ,p_cacheid(alloc_cacheid())
 {}
 
 ElementVoid::~ElementVoid()
@@ -77,6 +141,51 @@ void ElementVoid::assign(const ElementVoid *other)
     length = other->length;
     *const_cast<std::string*>(&name) = other->name;
     *const_cast<size_t*>(&index) = other->index;
+    // invalidate all existing caches
+    p_cacheid = alloc_cacheid();
+    p_cache.reset();
+}
+
+ElementVoid::Cache& ElementVoid::p_getCache(const StateBase& s) const
+{
+    Cache *C;
+    if(s.ctx) {
+        std::vector<ExecContext::entry>& caches = s.ctx->p_caches;
+        if(caches.size()<=index) {
+            ExecContext::entry empty = {0u, NULL};
+            caches.resize(index+1, empty);
+        }
+        ExecContext::entry& ent = caches[index];
+        if(ent.cacheid!=p_cacheid) {
+            // first use, or element re-configured, or from another Machine
+            delete ent.cache;
+            ent.cache = NULL;
+            ent.cache = allocCache();
+            ent.cacheid = p_cacheid;
+        }
+        C = ent.cache;
+    } else {
+        if(!p_cache)
+            p_cache.reset(allocCache());
+        C = p_cache.get();
+    }
+    if(!C)
+        throw std::logic_error(SB()<<"Element "<<name<<" ("<<type_name()<<") has no cache");
+    return *C;
+}
+
+ExecContext::ExecContext() {}
+
+ExecContext::~ExecContext()
+{
+    clear();
+}
+
+void ExecContext::clear()
+{
+    for(size_t i=0; i<p_caches.size(); i++)
+        delete p_caches[i].cache;
+    p_caches.clear();
 }
 
 Machine::Machine(const Config& c)
@@ -101,14 +210,14 @@ Machine::Machine(const Config& c)
     p_info = it->second;
 
     typedef Config::vector_t elements_t;
-    elements_t Es(c.get<elements_t>("elements"));
+    const elements_t& Es(c.get<elements_t>("elements"));
 
     p_elements_t result;
     p_lookup_t result_l, result_t;
     result.reserve(Es.size());
 
     size_t idx=0;
-    for(elements_t::iterator it=Es.begin(), end=Es.end(); it!=end; ++it)
+    for(elements_t::const_iterator it=Es.begin(), end=Es.end(); it!=end; ++it)
     {
         const Config& EC = *it;
 
@@ -168,26 +277,290 @@ Machine::~Machine()
 void
 Machine::propagate(StateBase* S, size_t start, int max) const
 {
-    const size_t nelem = p_elements.size();
+    p_propagate(NULL, p_elements, S, start, max, NULL, p_trace);
+}
+
+void
+Machine::propagate(ExecContext& ctx, StateBase* S, size_t start, int max) const
+{
+    p_propagate(&ctx, p_elements, S, start, max, NULL, p_trace);
+}
+
+// Copies the output State of selected elements into a BatchJob
+struct Machine::p_batch_observer
+{
+    BatchJob& job;
+    std::vector<bool> observe; // indexed by element index
+    p_batch_observer(BatchJob& job, size_t nelem)
+        :job(job)
+        ,observe(nelem, false)
+    {
+        for(size_t i=0; i<job.observe.size(); i++) {
+            if(job.observe[i]>=nelem)
+                throw std::invalid_argument("element index out of range");
+            observe[job.observe[i]] = true;
+        }
+    }
+    void view(const ElementVoid* elem, const StateBase* state)
+    {
+        if(observe[elem->index])
+            job.observed.push_back(std::make_pair(elem->index, std::unique_ptr<StateBase>(state->clone())));
+    }
+};
+
+void
+Machine::p_propagate(ExecContext *ctx, const p_elements_t& elements, StateBase* S,
+                     size_t start, int max, p_batch_observer *obs, std::ostream *trace) const
+{
+    const size_t nelem = elements.size();
+    ctx_guard G(S, ctx);
 
     S->next_elem = start;
     S->retreat = std::signbit(max);
 
+    // elements [n, unobserved) have no Observer
+    size_t unobserved = 0;
+
+    // p_extent does not apply to the elements of a BatchJob with overrides
+    const bool compiled = !p_extent.empty() && &elements==&p_elements;
+
     for(int i=0; S->next_elem<nelem && i<abs(max); i++)
     {
         size_t n = S->next_elem;
-        ElementVoid* E = p_elements[n];
+        ElementVoid* E = elements[n];
         if(S->retreat) {
             S->next_elem--;
         } else {
             S->next_elem++;
         }
+
+        if(!S->retreat && !trace) {
+            if(unobserved<=n) {
+                for(unobserved=n; unobserved<nelem; unobserved++) {
+                    if(obs ? obs->observe[unobserved] : !!elements[unobserved]->p_observe)
+                        break;
+                }
+            }
+            size_t count = std::min(unobserved-n, size_t(abs(max)-i));
+            if(compiled) {
+                count = std::min(count, p_extent[n]);
+            } else {
+                for(size_t r=0; r<count; r++) {
+                    if(!elements[n+r]->runnable()) {
+                        count = r;
+                        break;
+                    }
+                }
+            }
+
+            size_t adv;
+            if(count>=2 && (adv=E->advance_run(*S, &elements[n], count))!=0) {
+                // passed through elements [n, n+adv)
+                S->next_elem = n+adv;
+                i += adv-1;
+                continue;
+            }
+        }
+
         E->advance(*S);
 
-        if(E->p_observe)
+        if(obs)
+            obs->view(E, S);
+        else if(E->p_observe)
             E->p_observe->view(E, S);
-        if(p_trace)
-            (*p_trace) << "After ["<< n<< "] " << E->name << " " << *S << "\n";
+        if(trace)
+            (*trace) << "After ["<< n<< "] " << E->name << " " << *S << "\n";
+    }
+}
+
+void
+Machine::set_checkpoints(const std::vector<size_t>& idx)
+{
+    std::vector<size_t> sorted(idx);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    p_checkpoints.clear();
+    p_checkpoint_input.reset();
+    p_checkpoint_gen.clear();
+
+    for(size_t i=0; i<sorted.size(); i++) {
+        if(sorted[i]==0 || sorted[i]>=p_elements.size())
+            continue;
+        p_checkpoints.push_back(p_checkpoint_t());
+        p_checkpoints.back().index = sorted[i];
+    }
+}
+
+size_t
+Machine::propagate_incremental(StateBase* S, int max)
+{
+    const size_t nelem = p_elements.size();
+    if(max<0)
+        throw std::invalid_argument("propagate_incremental() does not support backward propagation");
+
+    size_t resume = 0;
+    p_checkpoint_t *from = NULL;
+
+    if(p_checkpoint_input && same_state(*p_checkpoint_input, *S)) {
+        // saved States before the first changed element are still valid
+        size_t changed = 0;
+        while(changed<nelem && p_elements[changed]->generation()==p_checkpoint_gen[changed])
+            changed++;
+
+        for(size_t i=0; i<p_checkpoints.size(); i++) {
+            p_checkpoint_t& C = p_checkpoints[i];
+            if(C.index>changed || C.index>size_t(max))
+                break;
+            else if(C.state)
+                from = &C;
+        }
+    } else {
+        p_checkpoint_input.reset(S->clone());
+    }
+
+    if(from)
+        resume = from->index;
+
+    p_checkpoint_gen.resize(nelem);
+    for(size_t i=0; i<nelem; i++)
+        p_checkpoint_gen[i] = p_elements[i]->generation();
+
+    for(size_t i=0; i<p_checkpoints.size(); i++) {
+        if(p_checkpoints[i].index>resume)
+            p_checkpoints[i].state.reset();
+    }
+
+    if(from)
+        S->assign(*from->state);
+
+    size_t next = resume;
+    int remaining = max-int(resume);
+
+    for(size_t i=0; i<p_checkpoints.size(); i++) {
+        p_checkpoint_t& C = p_checkpoints[i];
+        if(C.index<=next)
+            continue;
+        else if(C.index-next>size_t(remaining))
+            break;
+
+        p_propagate(NULL, p_elements, S, next, int(C.index-next), NULL, p_trace);
+        remaining -= int(C.index-next);
+        next = S->next_elem;
+
+        if(next!=C.index)
+            break; // element changed the order of propagation
+        C.state.reset(S->clone());
+    }
+
+    p_propagate(NULL, p_elements, S, next, remaining, NULL, p_trace);
+
+    return resume;
+}
+
+struct Machine::p_batch_runner
+{
+    const Machine& machine;
+    std::vector<BatchJob>& jobs;
+    const size_t start;
+    const int max;
+
+    info_mutex_t lock;
+    size_t next; // guarded by lock
+
+    p_batch_runner(const Machine& machine, std::vector<BatchJob>& jobs, size_t start, int max)
+        :machine(machine), jobs(jobs), start(start), max(max), next(0)
+    {}
+
+    void run_job(ExecContext& ctx, BatchJob& job)
+    {
+        job.observed.clear();
+        job.error.clear();
+        try {
+            const p_elements_t *elements = &machine.p_elements;
+
+            // elements replaced for this job
+            p_elements_t replaced;
+            std::vector<std::unique_ptr<ElementVoid> > owned;
+            if(!job.overrides.empty()) {
+                replaced = machine.p_elements;
+                for(size_t i=0; i<job.overrides.size(); i++) {
+                    const size_t idx = job.overrides[i].first;
+                    if(idx>=replaced.size())
+                        throw std::invalid_argument("element index out of range");
+                    owned.push_back(std::unique_ptr<ElementVoid>(machine.p_buildElement(idx, job.overrides[i].second)));
+                    replaced[idx] = owned.back().get();
+                }
+                elements = &replaced;
+            }
+
+            p_batch_observer obs(job, elements->size());
+
+            machine.p_propagate(&ctx, *elements, job.state, start, max, &obs, NULL);
+        }catch(std::exception& e){
+            job.error = e.what();
+            if(job.error.empty())
+                job.error = typeid(e).name();
+        }
+    }
+
+    // executed by each worker thread
+    void operator()()
+    {
+        ExecContext ctx;
+        while(true) {
+            size_t n;
+            {
+                info_mutex_t::scoped_lock G(lock);
+                if(next>=jobs.size())
+                    break;
+                n = next++;
+            }
+            run_job(ctx, jobs[n]);
+        }
+    }
+};
+
+void
+Machine::propagate_batch(std::vector<BatchJob>& jobs, size_t start, int max, unsigned nthreads) const
+{
+    for(size_t i=0; i<jobs.size(); i++) {
+        if(!jobs[i].state)
+            throw std::invalid_argument("propagate_batch() job without state");
+    }
+
+    if(nthreads==0)
+        nthreads = boost::thread::hardware_concurrency();
+    if(nthreads>jobs.size())
+        nthreads = jobs.size();
+
+    p_batch_runner runner(*this, jobs, start, max);
+
+    boost::thread_group workers;
+    try {
+        // the calling thread is also a worker
+        for(unsigned i=1; i<nthreads; i++)
+            workers.create_thread(boost::ref(runner));
+    }catch(...){
+        // complete remaining jobs with the threads we have
+    }
+
+    runner();
+    workers.join_all();
+}
+
+void
+Machine::propagate_batch(const std::vector<StateBase*>& states, size_t start, int max, unsigned nthreads) const
+{
+    std::vector<BatchJob> jobs(states.size());
+    for(size_t i=0; i<states.size(); i++)
+        jobs[i].state = states[i];
+
+    propagate_batch(jobs, start, max, nthreads);
+
+    for(size_t i=0; i<jobs.size(); i++) {
+        if(!jobs[i].error.empty())
+            throw std::runtime_error(SB()<<"propagate_batch() state "<<i<<" : "<<jobs[i].error);
     }
 }
 
@@ -211,6 +584,38 @@ void Machine::reconfigure(size_t idx, const Config& c)
     element_builder_t *builder = eit->second;
 
     builder->rebuild(p_elements[idx], c, idx);
+
+    if(compiled()) {
+        // update the runs which include, or end at, this element
+        const size_t nelem = p_elements.size();
+        p_extent[idx] = !p_elements[idx]->runnable() ? 0 : 1 + (idx+1<nelem ? p_extent[idx+1] : 0);
+        for(size_t i=idx; i>0 && p_elements[i-1]->runnable(); i--)
+            p_extent[i-1] = 1 + p_extent[i];
+    }
+}
+
+void Machine::compile()
+{
+    const size_t nelem = p_elements.size();
+    p_extent.resize(nelem);
+    for(size_t i=nelem; i>0; i--)
+        p_extent[i-1] = !p_elements[i-1]->runnable() ? 0 : 1 + (i<nelem ? p_extent[i] : 0);
+}
+
+ElementVoid* Machine::p_buildElement(size_t idx, const Config& c) const
+{
+    const std::string& etype(c.get<std::string>("type"));
+
+    state_info::elements_t::const_iterator eit = p_info.elements.find(etype);
+    if(eit==p_info.elements.end())
+        throw key_error(etype);
+
+    if(etype!=p_elements[idx]->type_name())
+        throw std::runtime_error("reconfigure() can't change element type");
+
+    ElementVoid *E = eit->second->build(c);
+    E->index = idx;
+    return E;
 }
 
 Machine::p_state_infos_t Machine::p_state_infos;
@@ -13,8 +13,29 @@ double Gaussian(double in, const double Q_ave, const double d)
     return 1e0/sqrt(2e0*M_PI)/d*exp(-0.5e0*sqr(in-Q_ave)/sqr(d));
 }
 
+ElementStripper::ElementStripper(const Config& c)
+    :base_t(c)
+{
+    length = 0e0;
+    update_misalign();
+
+    // stripper parameters are read once as they do not depend on the input state
+    Stripper_IonZ = c.get<double>("Stripper_IonZ", Stripper_IonZ_default);
+    Stripper_IonMass = c.get<double>("Stripper_IonMass", Stripper_IonMass_default);
+    Stripper_IonProton = c.get<double>("Stripper_IonProton", Stripper_IonProton_default);
+    Stripper_E1Para = c.get<double>("Stripper_E1Para", Stripper_E1Para_default);
+    Stripper_lambda = c.get<double>("Stripper_lambda", Stripper_lambda_default);
+    Stripper_upara = c.get<double>("Stripper_upara", Stripper_upara_default);
+
+    const std::vector<double> p1_default(Stripper_Para_default, Stripper_Para_default+3),
+                              p2_default(Stripper_E0Para_default, Stripper_E0Para_default+3);
+
+    Stripper_Para = c.get<std::vector<double> >("Stripper_Para", p1_default);
+    Stripper_E0Para = c.get<std::vector<double> >("Stripper_E0Para", p2_default);
+}
 
-void ElementStripper::StripperCharge(const double beta, double &Q_ave, double &d)
+
+void ElementStripper::StripperCharge(const double beta, double &Q_ave, double &d) const
 {
     // Baron's formula for carbon foil.
     double Q_ave1, Y;
@@ -26,7 +47,7 @@ void ElementStripper::StripperCharge(const double beta, double &Q_ave, double &d
 }
 
 
-void ElementStripper::ChargeStripper(const double beta, const std::vector<double>& ChgState, std::vector<double>& chargeAmount_Baron)
+void ElementStripper::ChargeStripper(const double beta, const std::vector<double>& ChgState, std::vector<double>& chargeAmount_Baron) const
 {
     unsigned    k;
     double Q_ave, d;
@@ -37,7 +58,7 @@ void ElementStripper::ChargeStripper(const double beta, const std::vector<double
 }
 
 
-void ElementStripper::Stripper_Propagate_ref(Particle &ref)
+void ElementStripper::Stripper_Propagate_ref(Particle &ref) const
 {
 
     // Change reference particle charge state.
@@ -52,7 +73,7 @@ void ElementStripper::Stripper_Propagate_ref(Particle &ref)
 }
 
 void ElementStripper::Stripper_GetMat(const Config &conf,
-                     MomentState &ST)
+                     MomentState &ST) const
 {
     unsigned               k, n;
     double                 tmptotCharge, Fy_abs_recomb, Ek_recomb, stdEkFoilVariation, ZpAfStr, growthRate;
@@ -74,19 +95,6 @@ void ElementStripper::Stripper_GetMat(const Config &conf,
     if(chrgmdl!="off" && chrgmdl!="baron")
         throw std::runtime_error("charge_model key word unknown, only \"baron\" and \"off\" supported by now");
 
-    Stripper_IonZ = conf.get<double>("Stripper_IonZ", Stripper_IonZ_default);
-    Stripper_IonMass = conf.get<double>("Stripper_IonMass", Stripper_IonMass_default);
-    Stripper_IonProton = conf.get<double>("Stripper_IonProton", Stripper_IonProton_default);
-    Stripper_E1Para = conf.get<double>("Stripper_E1Para", Stripper_E1Para_default);
-    Stripper_lambda = conf.get<double>("Stripper_lambda", Stripper_lambda_default);
-    Stripper_upara = conf.get<double>("Stripper_upara", Stripper_upara_default);
-
-    const std::vector<double> p1_default(Stripper_Para_default, Stripper_Para_default+3),
-                              p2_default(Stripper_E0Para_default, Stripper_E0Para_default+3);
-
-    Stripper_Para = conf.get<std::vector<double> >("Stripper_Para", p1_default);
-    Stripper_E0Para = conf.get<std::vector<double> >("Stripper_E0Para", p2_default);
-
     n = ChgState.size();
 
     if(chrgmdl=="off" )
@@ -180,7 +188,8 @@ void ElementStripper::Stripper_GetMat(const Config &conf,
         StatePtr->transmat[k]   = boost::numeric::ublas::identity_matrix<double>(PS_Dim);
     }
 
-    ST.calc_rms();
+    ST.touch_particles();
+    ST.invalidate_rms();
 }
 
 void ElementStripper::advance(StateBase &s)
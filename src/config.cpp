@@ -43,30 +43,31 @@ void Config::_cow()
 bool
 Config::tryGetAny(const std::string& name, value_t& ret) const
 {
-    values_t::const_iterator it=values->find(name);
-    if(it!=values->end()) {
-        ret = it->second;
+    const value_t *V = findAny(name);
+    if(V) {
+        ret = *V;
         return true;
     }
-    if(implicit_values) {
-        it = implicit_values->find(name);
-        if(it!=implicit_values->end()) {
-            ret = it->second;
-            return true;
-        }
-    }
     return false;
 }
 
-const Config::value_t&
-Config::getAny(const std::string& name) const
+const Config::value_t*
+Config::findAny(const std::string& name) const
 {
     values_t::const_iterator it=values->find(name);
-    if(it!=values->end()) return it->second;
+    if(it!=values->end()) return &it->second;
     if(implicit_values) {
         it = implicit_values->find(name);
-        if(it!=implicit_values->end()) return it->second;
+        if(it!=implicit_values->end()) return &it->second;
     }
+    return NULL;
+}
+
+const Config::value_t&
+Config::getAny(const std::string& name) const
+{
+    const value_t *V = findAny(name);
+    if(V) return *V;
     // abort();
     throw key_error(SB()<<"Config.getAny: missing parameter '"<<name<<"'");
 }
@@ -258,14 +259,122 @@ void assign_expr_to_Config(Config& conf, const std::string& name, const expr_t&
         throw std::logic_error("Context contained unresolved/illegal variable");
     }
 }
+
+// Increment when a change to the parser, or to the layout of cache files, changes
+// the result for the same input.  Existing cache files are then not re-used.
+const uint32_t cache_version = 1;
+
+// hash of parser input, used to name binary cache files
+struct cache_hash : public fnv1a_hash {
+    using fnv1a_hash::add;
+    void operator()(double v) { add(&v, sizeof(v)); }
+    void operator()(const std::string& v) { add(v); }
+    void operator()(const std::vector<double>& v)
+    {
+        uint64_t len = v.size();
+        add(&len, sizeof(len));
+        if(len)
+            add(&v[0], len*sizeof(double));
+    }
+    void operator()(const Config::vector_t&) {} // not passed to the parser
+};
 }
 
 struct GLPSParser::Pvt {
     typedef Config::values_t values_t;
     values_t vars;
     std::ostream *printer;
+    std::string cachedir;
 
-    Pvt() :printer(&std::cerr) {}
+    Pvt() :printer(&std::cerr), cachedir(default_cache_dir()) {}
+
+    //! Name of the cache file for the given input, or empty if caching is disabled
+    std::string cache_file(const char* s, size_t len, const char *path, const bool lattice) const
+    {
+        if(cachedir.empty())
+            return std::string();
+
+        cache_hash H;
+        H.add(&cache_version, sizeof(cache_version));
+        H.add(&len, sizeof(len));
+        H.add(s, len);
+        H.add(&lattice, sizeof(lattice));
+        // relative paths are expanded against both of these
+        H.add(path ? std::filesystem::weakly_canonical(path).string() : std::string());
+        H.add(std::filesystem::current_path().string());
+        for(values_t::const_iterator it=vars.begin(), end=vars.end(); it!=end; ++it)
+        {
+            H.add(it->first);
+            std::visit(H, it->second);
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.glpsb", (unsigned long long)H.val);
+        return (std::filesystem::path(cachedir) / name).string();
+    }
+
+    // A cache file holds the parser result in "config", and the paths expanded
+    // while parsing (see parse_context::resolved) in "resolved".
+    static
+    Config* load_cache(const std::string& fname)
+    {
+        try {
+            std::vector<char> buf;
+            if(!read_file(fname, buf))
+                return NULL;
+            std::unique_ptr<Config> entry(GLPSReadBinary(buf.empty() ? NULL : &buf[0], buf.size()));
+
+            const Config::vector_t& resolved = entry->get<Config::vector_t>("resolved");
+            for(size_t i=0; i<resolved.size(); i++) {
+                std::error_code err;
+                std::filesystem::path P(std::filesystem::canonical(resolved[i].get<std::string>("arg"), err));
+                if(err || P.string()!=resolved[i].get<std::string>("path"))
+                    return NULL; // moved or deleted since
+            }
+
+            return new Config(entry->get<Config::vector_t>("config").at(0));
+        } catch(std::exception&) {
+            return NULL; // stale or corrupt, parse again and replace
+        }
+    }
+
+    static
+    void store_cache(const std::string& fname, const Config& conf, const parse_context& ctxt)
+    {
+        Config::vector_t resolved(ctxt.resolved.size());
+        for(size_t i=0; i<resolved.size(); i++) {
+            resolved[i].set<std::string>("arg", ctxt.resolved[i].first);
+            resolved[i].set<std::string>("path", ctxt.resolved[i].second);
+        }
+
+        Config entry;
+        entry.set<Config::vector_t>("config", Config::vector_t(1, conf));
+        entry.set<Config::vector_t>("resolved", resolved);
+
+        std::ostringstream strm;
+        GLPSWriteBinary(strm, entry);
+        store_cache_file(fname, strm.str());
+    }
+
+    Config* parse(const char* s, size_t len, const char *path, const bool lattice=true)
+    {
+        std::string cfile(cache_file(s, len, path, lattice));
+        if(!cfile.empty()) {
+            Config *ret = load_cache(cfile);
+            if(ret)
+                return ret;
+        }
+
+        parse_context ctxt(path);
+        ctxt.printer = printer;
+        fill_vars(ctxt);
+        ctxt.parse(s, len);
+        std::unique_ptr<Config> ret(fill_context(ctxt, lattice));
+
+        if(!cfile.empty() && ctxt.cacheable)
+            store_cache(cfile, *ret, ctxt);
+        return ret.release();
+    }
 
     void fill_vars(parse_context& ctxt)
     {
@@ -325,13 +434,25 @@ struct GLPSParser::Pvt {
             Config::vector_t elements;
             elements.resize(line->names.size());
 
+            // Each element definition is translated once.  Repeated uses in the
+            // expanded beamline share this Config (copy on write), so curve arrays
+            // and other properties are not duplicated per occurrence.
+            Config::vector_t defs(ctxt.elements.size());
+            std::vector<char> defined(ctxt.elements.size(), 0);
+
             // copy in elements
             size_t i = 0;
             for(strlist_t::list_t::const_iterator it=line->names.begin(), end=line->names.end();
                 it!=end; ++it)
             {
+                const size_t eidx = ctxt.element_idx[*it];
+                if(defined[eidx]) {
+                    elements[i++] = defs[eidx];
+                    continue;
+                }
+
                 Config next(ret->new_scope()); // inhiert global scope
-                const parse_element& elem = ctxt.elements[ctxt.element_idx[*it]];
+                const parse_element& elem = ctxt.elements[eidx];
 
                 next.reserve(elem.props.size()+2);
 
@@ -346,6 +467,8 @@ struct GLPSParser::Pvt {
                 assert(!elem.etype.empty() && !elem.label.empty());
                 next.set<std::string>("type", elem.etype);
                 next.set<std::string>("name", elem.label);
+                defs[eidx] = next;
+                defined[eidx] = 1;
                 elements[i++].swap(next);
             }
 
@@ -375,6 +498,12 @@ GLPSParser::setPrinter(std::ostream* strm)
     priv->printer = strm;
 }
 
+void
+GLPSParser::setCacheDir(const std::string& dir)
+{
+    priv->cachedir = dir;
+}
+
 Config*
 GLPSParser::parse_file(const char *fname, const bool have_lattice)
 {
@@ -397,7 +526,20 @@ GLPSParser::parse_file(const char *fname, const bool have_lattice)
         throw std::runtime_error(strm.str());
     }
     try{
-        Config *ret = parse_file(have_lattice, fp, fpath.string().c_str());
+        Config *ret;
+        if(closeme && !priv->cachedir.empty()) {
+            // read the whole file so that its contents can be hashed
+            std::vector<char> buf;
+            char chunk[4096];
+            size_t n;
+            while((n=fread(chunk, 1, sizeof(chunk), fp))>0)
+                buf.insert(buf.end(), chunk, chunk+n);
+            if(ferror(fp))
+                throw std::runtime_error(SB()<<"Failed to read file '"<<fname<<"'");
+            ret = priv->parse(buf.empty() ? "" : &buf[0], buf.size(), fpath.string().c_str(), have_lattice);
+        } else {
+            ret = parse_file(have_lattice, fp, fpath.string().c_str());
+        }
         if(closeme) fclose(fp);
         return ret;
     }catch(...){
@@ -419,21 +561,13 @@ GLPSParser::parse_file(const bool have_lattice, FILE *fp, const char *path)
 Config*
 GLPSParser::parse_byte(const char* s, size_t len, const char *path)
 {
-    parse_context ctxt(path);
-    ctxt.printer = priv->printer;
-    priv->fill_vars(ctxt);
-    ctxt.parse(s, len);
-    return priv->fill_context(ctxt);
+    return priv->parse(s, len, path);
 }
 
 Config*
 GLPSParser::parse_byte(const std::string& s, const char *path)
 {
-    parse_context ctxt(path);
-    ctxt.printer = priv->printer;
-    priv->fill_vars(ctxt);
-    ctxt.parse(s);
-    return priv->fill_context(ctxt);
+    return priv->parse(s.c_str(), s.size(), path);
 }
 
 namespace {
@@ -0,0 +1,285 @@
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include <boost/numeric/conversion/cast.hpp>
+
+#include <flame/core/config.h>
+#include <flame/core/util.h>
+
+/* Binary Config format
+ *
+ * header
+ *   char     magic[8]   "FLAMECFG"
+ *   uint32   version
+ *   uint32   byte order marker 0x01020304
+ *   uint64   number of tables
+ * tables, each entry of a Config's values or implicit_values stored once.
+ *   uint64   number of entries
+ *   entry
+ *     uint32   key length
+ *     char[]   key
+ *     uint8    value type (index in Config::value_t)
+ *     (pad to 8 bytes)
+ *     value
+ *       double               8 bytes
+ *       std::vector<double>  uint64 count, then doubles
+ *       std::string          uint64 length, then chars (pad to 8 bytes)
+ *       std::vector<Config>  uint64 count, then a reference for each
+ * root reference
+ *
+ * A Config is referenced by two uint64, the index of its values table,
+ * and one plus the index of its implicit_values table (zero if none).
+ * Tables are written children first, so references always point backward.
+ */
+
+namespace {
+const char binary_magic[8] = {'F','L','A','M','E','C','F','G'};
+const uint32_t binary_version = 1;
+const uint32_t binary_order = 0x01020304;
+}
+
+namespace detail {
+struct config_codec
+{
+    typedef Config::values_t values_t;
+    typedef std::shared_ptr<values_t> table_t;
+
+    // writing
+
+    std::string out;
+    std::map<const values_t*, uint64_t> ids;
+
+    void pad()
+    {
+        out.resize((out.size()+7u)&~size_t(7u), '\0');
+    }
+
+    template<typename T>
+    void put(T v)
+    {
+        out.append((const char*)&v, sizeof(v));
+    }
+
+    void put_table(const values_t& V)
+    {
+        // nested Configs first
+        for(values_t::const_iterator it=V.begin(), end=V.end(); it!=end; ++it)
+        {
+            const Config::vector_t *C = std::get_if<Config::vector_t>(&it->second);
+            if(!C) continue;
+            for(size_t i=0, N=C->size(); i<N; i++)
+                visit((*C)[i]);
+        }
+
+        put<uint64_t>(V.size());
+        for(values_t::const_iterator it=V.begin(), end=V.end(); it!=end; ++it)
+        {
+            put<uint32_t>(boost::numeric_cast<uint32_t>(it->first.size()));
+            out.append(it->first);
+            put<uint8_t>(it->second.index());
+            pad();
+
+            switch(it->second.index()) {
+            case 0:
+                put(std::get<double>(it->second));
+                break;
+            case 1: {
+                const std::vector<double>& vect = std::get<std::vector<double> >(it->second);
+                put<uint64_t>(vect.size());
+                if(!vect.empty())
+                    out.append((const char*)&vect[0], vect.size()*sizeof(double));
+            }
+                break;
+            case 2: {
+                const std::string& str = std::get<std::string>(it->second);
+                put<uint64_t>(str.size());
+                out.append(str);
+                pad();
+            }
+                break;
+            case 3: {
+                const Config::vector_t& C = std::get<Config::vector_t>(it->second);
+                put<uint64_t>(C.size());
+                for(size_t i=0, N=C.size(); i<N; i++)
+                    put_ref(C[i]);
+            }
+                break;
+            }
+        }
+    }
+
+    // ensure that the tables of a Config have been written
+    void visit(const Config& C)
+    {
+        visit(C.values.get());
+        if(C.implicit_values)
+            visit(C.implicit_values.get());
+    }
+
+    void visit(const values_t *V)
+    {
+        if(ids.find(V)!=ids.end())
+            return;
+        put_table(*V);
+        uint64_t id = ids.size();
+        ids[V] = id;
+    }
+
+    void put_ref(const Config& C)
+    {
+        put<uint64_t>(ids[C.values.get()]);
+        put<uint64_t>(C.implicit_values ? 1u+ids[C.implicit_values.get()] : 0u);
+    }
+
+    // reading
+
+    const char *buf;
+    size_t len, pos;
+    std::vector<table_t> tables;
+
+    void need(size_t n) const
+    {
+        if(n>len-pos)
+            throw std::runtime_error("Binary Config truncated");
+    }
+
+    void skip_pad()
+    {
+        size_t next = (pos+7u)&~size_t(7u);
+        need(next-pos);
+        pos = next;
+    }
+
+    template<typename T>
+    T get()
+    {
+        T ret;
+        need(sizeof(T));
+        memcpy(&ret, buf+pos, sizeof(T));
+        pos += sizeof(T);
+        return ret;
+    }
+
+    // element count, checked against the remaining buffer to catch corrupt lengths early
+    size_t get_count(size_t elemsize)
+    {
+        uint64_t N = get<uint64_t>();
+        if(N>(len-pos)/elemsize)
+            throw std::runtime_error("Binary Config truncated");
+        return N;
+    }
+
+    void get_ref(Config& C)
+    {
+        uint64_t V = get<uint64_t>(), I = get<uint64_t>();
+        if(V>=tables.size() || I>tables.size())
+            throw std::runtime_error("Binary Config has invalid table reference");
+        // shared tables are copied by Config::_cow() before modification
+        C.values = tables[V];
+        if(I)
+            C.implicit_values = tables[I-1];
+        else
+            C.implicit_values.reset();
+    }
+
+    void get_table()
+    {
+        table_t V(new values_t);
+        size_t N = get_count(1);
+
+        for(size_t i=0; i<N; i++)
+        {
+            size_t klen = get<uint32_t>();
+            need(klen);
+            std::string key(buf+pos, klen);
+            pos += klen;
+            uint8_t type = get<uint8_t>();
+            skip_pad();
+
+            Config::value_t& val = (*V)[key];
+
+            switch(type) {
+            case 0:
+                val = get<double>();
+                break;
+            case 1: {
+                size_t count = get_count(sizeof(double));
+                val = std::vector<double>(count);
+                if(count)
+                    memcpy(&std::get<std::vector<double> >(val)[0], buf+pos, count*sizeof(double));
+                pos += count*sizeof(double);
+            }
+                break;
+            case 2: {
+                size_t count = get_count(1);
+                val = std::string(buf+pos, count);
+                pos += count;
+                skip_pad();
+            }
+                break;
+            case 3: {
+                size_t count = get_count(2*sizeof(uint64_t));
+                val = Config::vector_t(count);
+                Config::vector_t& C = std::get<Config::vector_t>(val);
+                for(size_t n=0; n<count; n++)
+                    get_ref(C[n]);
+            }
+                break;
+            default:
+                throw std::runtime_error(SB()<<"Binary Config has invalid value type "<<unsigned(type));
+            }
+        }
+        tables.push_back(V);
+    }
+};
+} // namespace detail
+
+void GLPSWriteBinary(std::ostream& strm, const Config& conf)
+{
+    detail::config_codec codec;
+
+    codec.out.append(binary_magic, sizeof(binary_magic));
+    codec.put(binary_version);
+    codec.put(binary_order);
+    size_t ntables = codec.out.size();
+    codec.put<uint64_t>(0u); // filled in below
+
+    codec.visit(conf);
+    codec.put_ref(conf);
+
+    uint64_t N = codec.ids.size();
+    memcpy(&codec.out[ntables], &N, sizeof(N));
+
+    strm.write(codec.out.c_str(), codec.out.size());
+}
+
+Config* GLPSReadBinary(const char *buf, size_t len)
+{
+    detail::config_codec codec;
+    codec.buf = buf;
+    codec.len = len;
+    codec.pos = 0u;
+
+    codec.need(sizeof(binary_magic));
+    if(memcmp(buf, binary_magic, sizeof(binary_magic))!=0)
+        throw std::runtime_error("Not a binary Config");
+    codec.pos += sizeof(binary_magic);
+
+    uint32_t version = codec.get<uint32_t>(),
+             order = codec.get<uint32_t>();
+    if(version!=binary_version || order!=binary_order)
+        throw std::runtime_error(SB()<<"Binary Config has unsupported version "<<version<<" or byte order");
+
+    size_t N = codec.get_count(sizeof(uint64_t));
+    codec.tables.reserve(N);
+    for(size_t i=0; i<N; i++)
+        codec.get_table();
+
+    std::unique_ptr<Config> ret(new Config);
+    codec.get_ref(*ret);
+    if(codec.pos!=len)
+        throw std::runtime_error("Binary Config has trailing bytes");
+    return ret.release();
+}
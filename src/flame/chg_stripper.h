@@ -74,23 +74,30 @@ struct ElementStripper : public MomentElementBase
     std::vector<double> Stripper_Para, Stripper_E0Para;
 
 
-    ElementStripper(const Config& c)
-        :base_t(c)
-    {
-        length = 0e0;
-    }
+    ElementStripper(const Config& c);
     virtual ~ElementStripper() {}
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        Stripper_IonZ      = O->Stripper_IonZ;
+        Stripper_IonMass   = O->Stripper_IonMass;
+        Stripper_IonProton = O->Stripper_IonProton;
+        Stripper_E1Para    = O->Stripper_E1Para;
+        Stripper_lambda    = O->Stripper_lambda;
+        Stripper_upara     = O->Stripper_upara;
+        Stripper_Para      = O->Stripper_Para;
+        Stripper_E0Para    = O->Stripper_E0Para;
+    }
 
     virtual void advance(StateBase &s) override final;
 
     virtual const char* type_name() const override final {return "stripper";}
 
-    void StripperCharge(const double beta, double &Q_ave, double &d);
-    void ChargeStripper(const double beta, const std::vector<double>& ChgState, std::vector<double>& chargeAmount_Baron);
-    void Stripper_Propagate_ref(Particle &ref);
-    void Stripper_GetMat(const Config &conf, MomentState &ST);
+    void StripperCharge(const double beta, double &Q_ave, double &d) const;
+    void ChargeStripper(const double beta, const std::vector<double>& ChgState, std::vector<double>& chargeAmount_Baron) const;
+    void Stripper_Propagate_ref(Particle &ref) const;
+    void Stripper_GetMat(const Config &conf, MomentState &ST) const;
 };
 
 #endif // CHG_STRIPPER_H
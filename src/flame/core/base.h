@@ -21,6 +21,7 @@
 #define FLAME_API_VERSION 0
 
 struct ElementVoid;
+struct ExecContext;
 
 /** @brief The abstract base class for all simulation state objects.
  *
@@ -38,6 +39,10 @@ struct StateBase : public boost::noncopyable
 
     bool retreat;      //!< retreat (backward) simulation flag
 
+    //! Context holding element caches for the current Machine::propagate(), or NULL.
+    //! Set by Machine::propagate().  Not copied by clone() or assign().
+    ExecContext *ctx;
+
     //! virtual equivalent to operator=()
     //! Should only be used with another State originating from the same Machine
     //! from Machine::allocState() or clone().
@@ -124,6 +129,10 @@ struct StateBase : public boost::noncopyable
      */
     virtual bool getArray(unsigned index, ArrayInfo& Info);
 
+    //! Called after a parameter has been changed through the ArrayInfo::ptr returned by getArray(index).
+    //! Callers which write through ArrayInfo::ptr must call this.
+    virtual void arrayChanged(unsigned index) {}
+
     //! Allocate a new instance which is a copy of this one.
     //! Caller is responsible to delete the returned pointer
     virtual StateBase* clone() const =0;
@@ -192,8 +201,44 @@ struct ElementVoid : public boost::noncopyable
     virtual const char* type_name() const =0;
 
     //! Propogate the given State through this Element
+    //! Sub-classes must not modify themselves here, but rather
+    //! keep any results to be re-used in a Cache (see cache()).
     virtual void advance(StateBase& s) =0;
 
+    /** @brief Mutable per-element state kept between calls to advance()
+     *
+     * eg. transfer matrices computed for some input State.
+     * Sub-classes which need this define a sub-class of Cache
+     * and override allocCache().
+     * Instances are owned by an ExecContext, or by the element itself
+     * when propagating without a context.
+     */
+    struct Cache : public boost::noncopyable
+    {
+        virtual ~Cache() {}
+    };
+
+    //! Allocate a new, empty, Cache for this element, or NULL if none is needed.
+    virtual Cache* allocCache() const { return NULL; }
+
+    //! True if advance_run() may pass through this element together with neighbouring elements.
+    //! Depends only on the configuration of this element, not on any State.
+    virtual bool runnable() const { return false; }
+
+    /** @brief Propagate the given State through this, and possibly some following, Elements at once.
+     *
+     * An optional optimization.  Called by Machine::propagate() in place of advance()
+     * for forward propagation when none of the elements [elems[0], elems[count-1]]
+     * have an Observer, and no trace is active.  elems[0] is this element, count>=2,
+     * and all of elems[0, count) are runnable().
+     *
+     * @returns The number of elements passed through (>0), or zero if advance() should be called instead.
+     */
+    virtual size_t advance_run(StateBase& s, ElementVoid* const* elems, size_t count) { return 0; }
+
+    //! Changes whenever this element is constructed or assign()ed.  Unique within a process.
+    inline size_t generation() const { return p_cacheid; }
+
     //! The Config used to construct this element.
     inline const Config& conf() const {return p_conf;}
 
@@ -219,12 +264,68 @@ struct ElementVoid : public boost::noncopyable
     //! Sub-classes must call base class assign()
     //! Come c++11 this can be replaced with a move ctor.
     virtual void assign(const ElementVoid* other ) =0;
+
+protected:
+    /** @brief Find the Cache to be used while propagating the given State
+     *
+     * Taken from StateBase::ctx if set, otherwise the cache owned by this element is used.
+     * Allocated with allocCache() on first use.
+     *
+     * @throws std::logic_error if allocCache() returns NULL
+     */
+    template<typename C>
+    inline C& cache(const StateBase& s) const
+    { return static_cast<C&>(p_getCache(s)); }
+
 private:
+    Cache& p_getCache(const StateBase& s) const;
+
     Observer *p_observe;
     Config p_conf;
+    //! Changes on construction and assign() to invalidate caches
+    size_t p_cacheid;
+    //! Used when propagating without an ExecContext
+    mutable std::unique_ptr<Cache> p_cache;
     friend class Machine;
 };
 
+/**
+ * @brief Holds the mutable Cache of each element for Machine::propagate()
+ *
+ * Allows a single Machine to be propagated concurrently by several threads,
+ * each using its own ExecContext.
+ * An ExecContext may be used with several Machines, though caches will be
+ * re-allocated when switching between them.
+ *
+ * @note An ExecContext is not thread-safe.
+ *       Each instance should be used by a single thread at a time.
+ *
+ * @code
+ * Machine M(...);
+ * // in each thread
+ * ExecContext ctx;
+ * std::unique_ptr<StateBase> S(M.allocState());
+ * M.propagate(ctx, S.get());
+ * @endcode
+ */
+struct ExecContext : public boost::noncopyable
+{
+    ExecContext();
+    ~ExecContext();
+
+    //! Discard all element caches
+    void clear();
+
+private:
+    struct entry {
+        size_t cacheid; //!< ElementVoid::p_cacheid when cache was allocated
+        ElementVoid::Cache *cache;
+    };
+    //! indexed by ElementVoid::index
+    std::vector<entry> p_caches;
+    friend struct ElementVoid;
+};
+
 /**
  * @brief The core simulate Machine engine
  *
@@ -232,7 +333,11 @@ private:
  *
  * @note A Machine instance is reentrant, but not thread-safe.
  *       Any thread may create a Machine at any time.
- *       However, each instance should be accessed by a single thread.
+ *       Several threads may concurrently call propagate(ExecContext&, ...),
+ *       each with its own ExecContext, so long as the Machine is not otherwise
+ *       modified (eg. reconfigure(), set_trace(), or ElementVoid::set_observer())
+ *       and any Observer is itself thread-safe.
+ *       Other access should be made by a single thread.
  */
 struct Machine : public boost::noncopyable
 {
@@ -255,6 +360,89 @@ struct Machine : public boost::noncopyable
                    size_t start=0,
                    int max=INT_MAX) const;
 
+    /** @brief Pass the given bunch State through this Machine, using the given context.
+     *
+     * As propagate(StateBase*,size_t,int) except that the element caches are taken
+     * from ctx instead of from the elements themselves.
+     *
+     * @param ctx Element caches to use.  Not to be used concurrently by another thread.
+     * @param S The initial state, will be updated with the final state
+     * @param start The index of the first Element the state will pass through
+     * @param max The maximum number of elements through which the state will be passed
+     */
+    void propagate(ExecContext& ctx,
+                   StateBase* S,
+                   size_t start=0,
+                   int max=INT_MAX) const;
+
+    //! A single, independent, propagation for propagate_batch()
+    struct BatchJob {
+        BatchJob() :state(NULL) {}
+        //! The initial state, will be updated with the final state.  Not owned.
+        StateBase *state;
+        //! Elements to be re-configured for this job only, as (index, Config).
+        //! As with reconfigure(), except that the Machine is not modified.
+        std::vector<std::pair<size_t, Config> > overrides;
+        //! Indices of elements whose output state should be copied into 'observed'
+        std::vector<size_t> observe;
+        //! Filled with (index, output state) of observed elements, in order of propagation.
+        std::vector<std::pair<size_t, std::unique_ptr<StateBase> > > observed;
+        //! Empty on success, otherwise the description of the error which stopped this job.
+        std::string error;
+    };
+
+    /** @brief Run several independent propagations concurrently.
+     *
+     * Jobs are handed out, one at a time, to a pool of worker threads
+     * (including the calling thread) each having its own ExecContext,
+     * which is re-used between jobs.
+     * Returns when all jobs have completed.
+     *
+     * Element observers and the trace stream are not used.
+     * Errors are reported for each job through BatchJob::error
+     *
+     * @param jobs The jobs to run.  Each must refer to a different State.
+     * @param start The index of the first Element each state will pass through
+     * @param max The maximum number of elements through which each state will be passed
+     * @param nthreads The maximum number of worker threads.  Zero selects the number of CPUs.
+     */
+    void propagate_batch(std::vector<BatchJob>& jobs,
+                         size_t start=0,
+                         int max=INT_MAX,
+                         unsigned nthreads=0) const;
+
+    /** @brief Pass several States concurrently through this Machine.
+     *
+     * Equivalent to calling propagate() for each of 'states', see propagate_batch(std::vector<BatchJob>&,...)
+     *
+     * @throws std::runtime_error describing the first failed propagation, after all have completed.
+     */
+    void propagate_batch(const std::vector<StateBase*>& states,
+                         size_t start=0,
+                         int max=INT_MAX,
+                         unsigned nthreads=0) const;
+
+    /** @brief Select the elements before which propagate_incremental() saves a copy of the State.
+     *
+     * Discards any previously saved States.
+     * @param idx Element indices.  Zero and out of range indices are ignored.
+     */
+    void set_checkpoints(const std::vector<size_t>& idx);
+
+    /** @brief As propagate(S, 0, max), resuming from a saved State where possible.
+     *
+     * Saves a copy of the State before each element selected by set_checkpoints().
+     * When called again with the same initial State, propagation resumes from
+     * the last saved State before the first element which has been changed
+     * (eg. by reconfigure()) since that State was saved.
+     * Observers of the elements before this point are not called.
+     *
+     * @param S The initial state, will be updated with the final state
+     * @param max The maximum number of elements through which the state will be passed.  Must not be negative.
+     * @returns The index of the element from which propagation resumed.  Zero if no saved State was used.
+     */
+    size_t propagate_incremental(StateBase* S, int max=INT_MAX);
+
     /** @brief Allocate (with "operator new") an appropriate State object
      *
      * @param c Configuration describing the initial state
@@ -290,6 +478,18 @@ struct Machine : public boost::noncopyable
      */
     void reconfigure(size_t idx, const Config& c);
 
+    /** @brief Pre-compute how propagate() groups elements.
+     *
+     * An optional optimization for Machines which are propagated many times.
+     * Saves the length of the run of runnable() elements starting with each element,
+     * so that propagate() need not find it again on each call.
+     * Kept up to date by reconfigure().
+     */
+    void compile();
+
+    //! True after compile()
+    inline bool compiled() const { return !p_extent.empty(); }
+
     //! Return the sim_type string found during construction.
     inline const std::string& simtype() const {return p_simtype;}
 
@@ -307,6 +507,17 @@ struct Machine : public boost::noncopyable
 private:
     typedef std::vector<ElementVoid*> p_elements_t;
 
+    struct p_batch_observer;
+
+    //! If obs!=NULL then it is used instead of the element Observers
+    void p_propagate(ExecContext *ctx, const p_elements_t& elements, StateBase* S,
+                     size_t start, int max, p_batch_observer *obs, std::ostream *trace) const;
+
+    //! Construct a new element at index idx, as it would be by reconfigure()
+    ElementVoid* p_buildElement(size_t idx, const Config& c) const;
+
+    struct p_batch_runner;
+
     struct LookupKey {
         std::string name;
         size_t index;
@@ -399,6 +610,20 @@ private:
     std::ostream* p_trace;
     Config p_conf;
 
+    //! # of consecutive runnable() elements starting with each element after compile(), otherwise empty
+    std::vector<size_t> p_extent;
+
+    //! State saved before element 'index' by propagate_incremental()
+    struct p_checkpoint_t {
+        size_t index;
+        std::unique_ptr<StateBase> state; //!< NULL until saved
+    };
+    std::vector<p_checkpoint_t> p_checkpoints; //!< sorted by index
+    //! Initial State of the last propagate_incremental()
+    std::unique_ptr<StateBase> p_checkpoint_input;
+    //! ElementVoid::generation() of each element when p_checkpoints were saved
+    std::vector<size_t> p_checkpoint_gen;
+
     typedef StateBase* (*state_builder_t)(const Config& c);
     template<typename State>
     struct state_builder_impl {
@@ -56,6 +56,8 @@ struct is_config_value {
 };
 #define IS_CONFIG_VALUE(TYPE) \
 namespace detail {template<> struct is_config_value<TYPE> { typedef TYPE type; };}
+
+struct config_codec;
 } // namespace detail
 IS_CONFIG_VALUE(double)
 IS_CONFIG_VALUE(std::string)
@@ -97,6 +99,8 @@ private:
     const_values_pointer implicit_values;
 
     void _cow();
+
+    friend struct detail::config_codec;
 public:
     //! New empty config
     Config();
@@ -111,6 +115,10 @@ public:
      * @returns true if 'ret' updates, and false if no parameter with 'name'.
      */
     bool tryGetAny(const std::string& name, value_t& ret) const;
+    /** lookup untyped, without copying.
+     * @returns The value, or NULL if no parameter with 'name'.  Valid until this Config is modified.
+     */
+    const value_t* findAny(const std::string& name) const;
     /** lookup untyped.
      * @throws key_error if name doesn't refer to an existing parameter
      */
@@ -151,11 +159,10 @@ public:
     template<typename T>
     typename detail::RT<T>::type
     get(const std::string& name, typename boost::call_traits<T>::param_type def) const {
-        try{
-            return std::get<typename detail::is_config_value<T>::type>(getAny(name));
-        } catch(std::bad_variant_access&) {
-        } catch(key_error&) {
-        }
+        const value_t *V = findAny(name);
+        const typename detail::is_config_value<T>::type *val = V ? std::get_if<typename detail::is_config_value<T>::type>(V) : NULL;
+        if(val)
+            return *val;
         return def;
     }
 
@@ -166,13 +173,11 @@ public:
     template<typename T>
     bool
     tryGet(const std::string& name, T& val) const {
-        value_t ret;
-        if(tryGetAny(name, ret)) {
-            try{
-                val = std::get<typename detail::is_config_value<T>::type>(ret);
-                return true;
-            } catch(std::bad_variant_access&) {
-            }
+        const value_t *V = findAny(name);
+        const typename detail::is_config_value<T>::type *ret = V ? std::get_if<typename detail::is_config_value<T>::type>(V) : NULL;
+        if(ret) {
+            val = *ret;
+            return true;
         }
         return false;
     }
@@ -268,6 +273,17 @@ public:
     void setVar(const std::string& name, const Config::value_t& v);
     //! @brief Set output for lexer/parser error messages
     void setPrinter(std::ostream*);
+    /** @brief Set directory used to cache parse results
+     *
+     * When set, the result of parsing a file or buffer is stored in binary form (see GLPSWriteBinary())
+     * under a name derived from a hash of the input text, the directory used to expand relative paths,
+     * and any variables set with setVar().  Later parses of identical input load this file
+     * instead of re-running the parser.
+     *
+     * Inputs which use print() or parse() are never cached.
+     * Initialized from the environment variable FLAME_LATTICE_CACHE.  An empty string disables caching.
+     */
+    void setCacheDir(const std::string& dir);
 
     /** @brief Open and parse a file
      *
@@ -307,6 +323,19 @@ public:
 //! Print a previously parsed, or constructed, Config
 void GLPSPrint(std::ostream& strm, const Config&);
 
+/** @brief Serialize a Config in binary form
+ *
+ * Scopes shared between several Configs (eg. repeated elements) are stored once.
+ * The format is versioned and native byte order.  Vector data is 8 byte aligned.
+ */
+void GLPSWriteBinary(std::ostream& strm, const Config&);
+/** @brief Reconstruct a Config written by GLPSWriteBinary()
+ *
+ * @returns New Config, which the caller must delete.
+ * @throws std::runtime_error If the buffer is truncated, corrupt, or written by an incompatible version.
+ */
+Config* GLPSReadBinary(const char *buf, size_t len);
+
 
 #undef IS_CONFIG_VALUE
 
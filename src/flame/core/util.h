@@ -1,9 +1,15 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <ostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
 
 #include <boost/call_traits.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
@@ -80,9 +86,72 @@ struct numeric_table {
     value_t table;
 
     void read(std::istream&);
+    //! Parse text from a buffer
+    void read(const char *buf, size_t len);
     void readvec(std::vector<double> vec, int numrow);
+
+    /** Serialize in binary form.
+     *
+     * Versioned and native byte order.  Values are stored in the row-major order of value_t,
+     * 8 byte aligned, so that they may be loaded with a single copy.
+     */
+    void write_binary(std::ostream&) const;
+    //! Load a table written by write_binary().  Throws std::runtime_error if truncated or corrupt.
+    void read_binary(const char *buf, size_t len);
+    //! Test if a buffer starts with the header written by write_binary()
+    static bool is_binary(const char *buf, size_t len);
 };
 
+/** Process wide cache of objects loaded from external data files.
+ *
+ * Entries are keyed by a kind, which names how the files are loaded, and the list of files loaded.
+ * An entry is loaded again when any of its files is modified.
+ * Lookups take no lock, so concurrent Machine construction does not serialize on cache hits.
+ * At most capacity() entries are kept, the least recently used are dropped first.
+ * Dropped entries remain valid as long as a caller holds a reference.
+ */
+class data_file_cache {
+    struct Pvt;
+    std::unique_ptr<Pvt> pvt;
+public:
+    data_file_cache();
+    ~data_file_cache();
+
+    typedef std::vector<std::string> files_t;
+    typedef std::shared_ptr<const void> value_pointer;
+    typedef std::function<value_pointer()> loader_t;
+
+    //! Find, or call load() to create, the entry for these files.  Exceptions from load() are not cached.
+    value_pointer fetch_any(const std::string& kind, const files_t& files, const loader_t& load);
+
+    //! Typed fetch_any().  F must return a std::shared_ptr<T> or std::shared_ptr<const T>.
+    template<typename T, typename F>
+    std::shared_ptr<const T> fetch(const std::string& kind, const files_t& files, F load)
+    {
+        return std::static_pointer_cast<const T>(fetch_any(kind, files, [&load]() -> value_pointer {
+            return std::shared_ptr<const T>(load());
+        }));
+    }
+
+    //! Drop all entries which depend on this file
+    void invalidate(const std::string& file);
+    //! Drop all entries
+    void clear();
+    //! Drop all entries of one kind
+    void clear(const std::string& kind);
+
+    size_t capacity() const;
+    void set_capacity(size_t);
+
+    struct stats_t {
+        size_t size, hits, misses, evictions;
+    };
+    stats_t stats() const;
+
+    static data_file_cache* get();
+};
+
+//! Loads numeric_table files through data_file_cache
 class numeric_table_cache {
     struct Pvt;
     std::unique_ptr<Pvt> pvt;
@@ -92,10 +161,20 @@ public:
 
     typedef std::shared_ptr<const numeric_table> table_pointer;
 
+    /** Fetch table from a text or binary (see numeric_table::write_binary()) file.
+     *
+     * Tables are kept in data_file_cache until the file is modified.
+     * If a cache directory is set, text files are converted to binary form there,
+     * and later parses of identical files load the binary copy.
+     */
     table_pointer fetch(const std::string& path);
 
+    //! Drop all tables
     void clear();
 
+    //! Set directory used to cache binary tables.  Initialized from $FLAME_LATTICE_CACHE.  Empty to disable.
+    void setCacheDir(const std::string& dir);
+
     static numeric_table_cache* get();
 };
 
@@ -107,6 +186,39 @@ struct SB {
     SB& operator<<(T i) { strm<<i; return *this; }
 };
 
+//! FNV-1a hash, used to name cache files
+struct fnv1a_hash {
+    uint64_t val;
+    fnv1a_hash() :val(14695981039346656037ull) {}
+    void add(const void *raw, size_t len)
+    {
+        const unsigned char *buf = (const unsigned char*)raw;
+        for(size_t i=0; i<len; i++) {
+            val ^= buf[i];
+            val *= 1099511628211ull;
+        }
+    }
+    void add(const std::string& s)
+    {
+        uint64_t len = s.size();
+        add(&len, sizeof(len));
+        add(s.c_str(), s.size());
+    }
+};
+
+//! Cache directory named by $FLAME_LATTICE_CACHE, or empty if not set
+std::string default_cache_dir();
+
+//! Read the entire contents of a file.  Returns false if it can not be opened or read.
+bool read_file(const std::string& fname, std::vector<char>& buf);
+
+/** Replace the contents of a cache file.
+ *
+ * Writes to a temporary name, then renames, so that concurrent readers never see a partial file.
+ * The directory is created if necessary.  Errors are ignored as a cache is only an optimization.
+ */
+void store_cache_file(const std::string& fname, const std::string& contents);
+
 //! Helper to step through the indicies of an Nd array
 template<unsigned MAX>
 struct ndindex_iterate {
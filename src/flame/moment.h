@@ -40,20 +40,48 @@ struct Particle {
         = SampleFreq = SampleLambda
         = SampleIonK = IonEk
         = std::numeric_limits<double>::quiet_NaN();
+        last.IonEs = last.IonEk = last.SampleFreq = last.IonW
+        = last.gamma = last.beta = last.bg
+        = last.SampleLambda = last.SampleIonK
+        = std::numeric_limits<double>::quiet_NaN();
     }
 
     //! Recalculate dependent (cached) values.
     //! Call after changing IonEs or IonEk
+    //! Does nothing when neither the independent values nor the dependents
+    //! have been touched since the previous call.
     void recalc() {
+        if(IonEk==last.IonEk && IonEs==last.IonEs && SampleFreq==last.SampleFreq
+                && IonW==last.IonW && gamma==last.gamma && beta==last.beta && bg==last.bg
+                && SampleLambda==last.SampleLambda && SampleIonK==last.SampleIonK)
+            return;
         IonW       = IonEs + IonEk;
         gamma      = (IonEs != 0e0)? IonW/IonEs : 1e0;
         beta       = sqrt(1e0-1e0/(gamma*gamma));
         bg         = (beta != 0e0)? beta*gamma : 1e0;
         SampleLambda = C0/SampleFreq*MtoMM;
         SampleIonK   = 2e0*M_PI/(beta*SampleLambda);
+
+        last.IonEs      = IonEs;
+        last.IonEk      = IonEk;
+        last.SampleFreq = SampleFreq;
+        last.IonW       = IonW;
+        last.gamma      = gamma;
+        last.beta       = beta;
+        last.bg         = bg;
+        last.SampleLambda = SampleLambda;
+        last.SampleIonK   = SampleIonK;
     }
 
     double Brho() const { return beta*IonW/(C0*IonZ); } //!< Magnetic rigidity.
+
+private:
+    //! Values seen by the last recalc().
+    //! Dependents are included as some code (eg. RF cavity) overwrites them directly.
+    struct {
+        double IonEs, IonEk, SampleFreq,
+               IonW, gamma, beta, bg, SampleLambda, SampleIonK;
+    } last;
 };
 
 std::ostream& operator<<(std::ostream&, const Particle&);
@@ -117,12 +145,24 @@ struct MomentState : public StateBase
     std::vector<matrix_t> moment1;
     std::vector<matrix_t> transmat;
 
-    vector_t moment0_env, moment0_rms;
-    matrix_t moment1_env;
+    //! Averages over all charge states, derived from moment0 and moment1 by calc_rms().
+    //! Elements only invalidate_rms(), so call update_rms() before reading these directly.
+    //! getArray() and show() do so.
+    mutable vector_t moment0_env, moment0_rms;
+    mutable matrix_t moment1_env;
 
     double last_caviphi0;
 
+    //! Identifies the present values of 'ref' and 'real[]'.
+    //! States with equal tags have equal Particles, so element caches may compare tags
+    //! before comparing Particles.  Code which changes 'ref' or 'real[]' must call touch_particles().
+    //! arrayChanged() does so for changes made through getArray() pointers (eg. from python).
+    size_t particle_tag;
+    //! Assign a new particle_tag, which no other state has
+    void touch_particles();
+
     virtual bool getArray(unsigned idx, ArrayInfo& Info) override final;
+    virtual void arrayChanged(unsigned idx) override final { touch_particles(); }
 
     virtual MomentState* clone() const override final {
         return new MomentState(*this, clone_tag());
@@ -133,12 +173,19 @@ struct MomentState : public StateBase
         for(size_t i=0; i<real.size(); i++) real[i].recalc();
     }
 
-    void calc_rms();
+    //! Re-compute moment0_env, moment0_rms, and moment1_env now
+    void calc_rms() const;
+    //! Mark moment0_env, moment0_rms, and moment1_env as out of date, eg. after moment0 or moment1 are changed.
+    void invalidate_rms() { rms_valid = false; }
+    //! calc_rms() if invalidate_rms() has been called since it was last run
+    void update_rms() const { if(!rms_valid) calc_rms(); }
 
     inline size_t size() const { return real.size(); } //!< # of charge states
 
 protected:
     MomentState(const MomentState& o, clone_tag);
+private:
+    mutable bool rms_valid;
 };
 
 /** @brief An Element which propagates the statistical moments of a bunch
@@ -149,50 +196,105 @@ struct MomentElementBase : public ElementVoid
 
     typedef state_t::matrix_t value_t;
 
+    //! Structure of a transfer matrix, which selects the kernels used to apply it.
+    //! Blocks are square, on the diagonal, and the last row/column are those of identity.
+    enum sparsity_t {
+        Identity, //!< no-op
+        Block2,   //!< (x, px), (y, py) and (s, ps) are independent
+        Block4,   //!< transverse (x, px, y, py) coupled, (s, ps) independent
+        Dense,
+    };
+
     MomentElementBase(const Config& c);
     virtual ~MomentElementBase();
 
+    //! Results of the last advance(), re-used while the input state is unchanged
+    struct cache_t : public ElementVoid::Cache
+    {
+        cache_t();
+        virtual ~cache_t();
+
+        Particle last_ref_in, last_ref_out;
+        std::vector<Particle> last_real_in, last_real_out;
+        //! MomentState::particle_tag of last_*_in and last_*_out.  Zero if not known.
+        size_t last_tag_in, last_tag_out;
+        //! final transfer matricies
+        std::vector<value_t> transfer;
+        //! MatSparsity() of each 'transfer'
+        std::vector<sparsity_t> sparsity;
+        //! Inverse of each 'transfer' for backward propagation.
+        //! Computed on first use, empty when 'transfer' has changed since.
+        std::vector<value_t> transfer_inv;
+        std::vector<value_t> misalign, misalign_inv;
+
+        // scratch space to avoid temp. allocation in advance()
+        state_t::matrix_t scratch;
+
+        //! Product of the transfer matricies of a run of passive() elements starting with this one.
+        //! Valid for the recorded input state while no element in the run is re-configured.
+        struct run_t {
+            run_t() :count(0), tag_in(0), tag_out(0), length(0e0) {}
+            size_t count; //!< # of elements in the run, zero if not valid
+            std::vector<size_t> generation; //!< ElementVoid::generation() of each element
+            Particle ref_in, ref_out;
+            std::vector<Particle> real_in, real_out;
+            size_t tag_in, tag_out; //!< MomentState::particle_tag of *_in and *_out
+            std::vector<value_t> composite, transmat;
+            std::vector<sparsity_t> sparsity; //!< of composite
+            double length;
+        } run;
+    };
+
+    virtual Cache* allocCache() const override { return new cache_t; }
+
     void get_misalign(const state_t& ST, const Particle& real, value_t& M, value_t& IM) const;
 
-    unsigned get_flag(const Config& c, const std::string& name, const unsigned& def_value);
+    unsigned get_flag(const Config& c, const std::string& name, const unsigned& def_value) const;
 
     virtual void advance(StateBase& s) override;
 
+    //! passive() elements without skipcache
+    virtual bool runnable() const override { return !skipcache && passive(); }
+
+    //! Pass through a run of passive() elements by applying their combined transfer matricies.
+    virtual size_t advance_run(StateBase& s, ElementVoid* const* elems, size_t count) override;
+
+    //! True if this element uses the default, linear, advance() which preserves the # of charge states.
+    //! Only then may advance_run() pass through it without calling its advance().
+    //! Sub-classes which keep the default advance() should override this to return true.
+    virtual bool passive() const { return false; }
+
     //! Return true if previously calculated 'transfer' matricies may be reused
     //! Should compare new input state against values used when 'transfer' was
     //! last computed
-    virtual bool check_cache(const state_t& S) const;
+    virtual bool check_cache(const state_t& S, const cache_t& C) const;
 
     //! Check input state for backward propagation
-    virtual bool check_backward(const state_t& S) const;
+    virtual bool check_backward(const state_t& S, const cache_t& C) const;
 
     //! Helper to resize our std::vector s to match the # of charge states
     //! in the provided new input state.
-    void resize_cache(const state_t& ST);
+    void resize_cache(const state_t& ST, cache_t& C) const;
 
     //! recalculate 'transfer' taking into consideration the provided input state
-    virtual void recompute_matrix(state_t& ST);
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const;
 
     virtual void show(std::ostream& strm, int level) const override;
 
-    Particle last_ref_in, last_ref_out;
-    std::vector<Particle> last_real_in, last_real_out;
-    //! final transfer matricies
-    std::vector<value_t> transfer;
-    std::vector<value_t> misalign, misalign_inv;
-
     //! constituents of misalign
     double dx, dy, pitch, yaw, roll;
 
+    //! State independent part of the misalignment matrices (and inverse), from dx, dy, pitch, yaw, roll and length.
+    //! get_misalign() only applies the energy dependent scaling of the longitudinal coordinates.
+    //! Must be re-computed with update_misalign() when any of these change.
+    value_t misalign_geom, misalign_geom_inv;
+
+    void update_misalign();
+
     //! If set, check_cache() will always return false
     bool skipcache;
 
     virtual void assign(const ElementVoid *other) =0;
-
-protected:
-    // scratch space to avoid temp. allocation in advance()
-    // An Element can't be shared between multiple threads
-    state_t::matrix_t scratch;
 };
 
 #endif // FLAME_MOMENT_H
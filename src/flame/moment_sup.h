@@ -2,13 +2,211 @@
 #define MOMENT2_SUP_H
 
 #include <vector>
+#include <algorithm>
+#include <cassert>
 #include "flame/core/base.h"
 #include "moment.h"
 
-static std::map<std::string,std::shared_ptr<Config> > CurveMap;
-
 void inverse(MomentElementBase::value_t& out, const MomentElementBase::value_t& in);
 
+/* Fixed size kernels for MomentState::maxsize square matrices and vectors.
+ *
+ * These work directly on the contiguous row-major storage of matrix_t/vector_t
+ * with compile time bounds, which the compiler can fully unroll and vectorize,
+ * instead of going through the generic (run time sized) ublas prod().
+ * The order of summation is the same as ublas prod(), so results are identical.
+ *
+ * Unless noted, outputs must not alias inputs.
+ */
+
+//! C = A*B
+inline void MatMult(const MomentElementBase::value_t& A, const MomentElementBase::value_t& B,
+                    MomentElementBase::value_t& C)
+{
+    enum {N=MomentState::maxsize};
+    assert(A.size1()==N && A.size2()==N && B.size1()==N && B.size2()==N);
+    C.resize(N, N, false);
+    const double * __restrict a = &A.data()[0];
+    const double * __restrict b = &B.data()[0];
+    double * __restrict c = &C.data()[0];
+
+    for(unsigned i=0; i<N; i++) {
+        double row[N] = {};
+        for(unsigned k=0; k<N; k++) {
+            const double aik = a[i*N+k];
+            for(unsigned j=0; j<N; j++)
+                row[j] += aik*b[k*N+j];
+        }
+        for(unsigned j=0; j<N; j++)
+            c[i*N+j] = row[j];
+    }
+}
+
+//! C = A*trans(B)
+inline void MatMultTrans(const MomentElementBase::value_t& A, const MomentElementBase::value_t& B,
+                         MomentElementBase::value_t& C)
+{
+    enum {N=MomentState::maxsize};
+    assert(A.size1()==N && A.size2()==N && B.size1()==N && B.size2()==N);
+    C.resize(N, N, false);
+    const double * __restrict a = &A.data()[0];
+    const double * __restrict b = &B.data()[0];
+    double * __restrict c = &C.data()[0];
+
+    for(unsigned i=0; i<N; i++) {
+        double row[N] = {};
+        for(unsigned k=0; k<N; k++) {
+            const double aik = a[i*N+k];
+            for(unsigned j=0; j<N; j++)
+                row[j] += aik*b[j*N+k];
+        }
+        for(unsigned j=0; j<N; j++)
+            c[i*N+j] = row[j];
+    }
+}
+
+//! B = A*B (in place)
+inline void MatMultLeft(const MomentElementBase::value_t& A, MomentElementBase::value_t& B)
+{
+    MomentElementBase::value_t T;
+    MatMult(A, B, T);
+    B = T;
+}
+
+//! x = A*x (in place)
+inline void MatVecMult(const MomentElementBase::value_t& A, MomentState::vector_t& x)
+{
+    enum {N=MomentState::maxsize};
+    assert(A.size1()==N && A.size2()==N && x.size()==N);
+    const double * __restrict a = &A.data()[0];
+    double *v = &x.data()[0];
+    double y[N] = {};
+
+    for(unsigned i=0; i<N; i++)
+        for(unsigned k=0; k<N; k++)
+            y[i] += a[i*N+k]*v[k];
+    for(unsigned i=0; i<N; i++)
+        v[i] = y[i];
+}
+
+//! S = M*S*trans(M) (in place), 'scratch' is overwritten
+inline void MatSandwich(const MomentElementBase::value_t& M, MomentElementBase::value_t& S,
+                        MomentElementBase::value_t& scratch)
+{
+    MatMult(M, S, scratch);
+    MatMultTrans(scratch, M, S);
+}
+
+/* Kernels for transfer matrices with block diagonal structure (see MomentElementBase::sparsity_t).
+ *
+ * Only terms which are not structurally zero are summed, in the same order as the
+ * dense kernels above.  As a sum starting from +0 is unchanged by adding zeros,
+ * results are identical.
+ */
+
+//! Classify the structure of M
+MomentElementBase::sparsity_t MatSparsity(const MomentElementBase::value_t& M);
+
+//! True if A and B have the same shape and elements
+inline bool MatEqual(const MomentElementBase::value_t& A, const MomentElementBase::value_t& B)
+{
+    return A.size1()==B.size1() && A.size2()==B.size2()
+            && std::equal(A.data().begin(), A.data().begin()+A.size1()*A.size2(), B.data().begin());
+}
+
+namespace detail {
+// half open range [lo, hi) of the columns of row i which may be non-zero
+template<MomentElementBase::sparsity_t S>
+struct sparsity_range {
+    enum {N=MomentState::maxsize};
+    static inline unsigned lo(unsigned i) {
+        if(S==MomentElementBase::Dense) return 0;
+        else if(i==N-1) return i;
+        else if(S==MomentElementBase::Block4 && i<4) return 0;
+        else return i&~1u;
+    }
+    static inline unsigned hi(unsigned i) {
+        if(S==MomentElementBase::Dense) return N;
+        else if(i==N-1) return N;
+        else if(S==MomentElementBase::Block4 && i<4) return 4;
+        else return (i&~1u)+2;
+    }
+};
+
+template<MomentElementBase::sparsity_t S>
+inline void MatVecMultS(const MomentElementBase::value_t& A, MomentState::vector_t& x)
+{
+    typedef sparsity_range<S> R;
+    enum {N=MomentState::maxsize};
+    const double * __restrict a = &A.data()[0];
+    double *v = &x.data()[0];
+    double y[N] = {};
+
+    for(unsigned i=0; i<N; i++)
+        for(unsigned k=R::lo(i); k<R::hi(i); k++)
+            y[i] += a[i*N+k]*v[k];
+    for(unsigned i=0; i<N; i++)
+        v[i] = y[i];
+}
+
+template<MomentElementBase::sparsity_t S>
+inline void MatSandwichS(const MomentElementBase::value_t& M, MomentElementBase::value_t& S_,
+                         MomentElementBase::value_t& scratch)
+{
+    typedef sparsity_range<S> R;
+    enum {N=MomentState::maxsize};
+    scratch.resize(N, N, false);
+    const double * __restrict m = &M.data()[0];
+    double * __restrict s = &S_.data()[0];
+    double * __restrict t = &scratch.data()[0];
+
+    // scratch = M*S
+    for(unsigned i=0; i<N; i++) {
+        double row[N] = {};
+        for(unsigned k=R::lo(i); k<R::hi(i); k++) {
+            const double mik = m[i*N+k];
+            for(unsigned j=0; j<N; j++)
+                row[j] += mik*s[k*N+j];
+        }
+        for(unsigned j=0; j<N; j++)
+            t[i*N+j] = row[j];
+    }
+    // S = scratch*trans(M)
+    for(unsigned i=0; i<N; i++) {
+        for(unsigned j=0; j<N; j++) {
+            double sum = 0e0;
+            for(unsigned k=R::lo(j); k<R::hi(j); k++)
+                sum += t[i*N+k]*m[j*N+k];
+            s[i*N+j] = sum;
+        }
+    }
+}
+} // namespace detail
+
+//! x = A*x (in place), where A has structure S
+inline void MatVecMult(const MomentElementBase::value_t& A, MomentState::vector_t& x,
+                       MomentElementBase::sparsity_t S)
+{
+    switch(S) {
+    case MomentElementBase::Identity: break;
+    case MomentElementBase::Block2: detail::MatVecMultS<MomentElementBase::Block2>(A, x); break;
+    case MomentElementBase::Block4: detail::MatVecMultS<MomentElementBase::Block4>(A, x); break;
+    default: MatVecMult(A, x);
+    }
+}
+
+//! S = M*S*trans(M) (in place), where M has structure Sp, 'scratch' is overwritten
+inline void MatSandwich(const MomentElementBase::value_t& M, MomentElementBase::value_t& S,
+                        MomentElementBase::value_t& scratch, MomentElementBase::sparsity_t Sp)
+{
+    switch(Sp) {
+    case MomentElementBase::Identity: break;
+    case MomentElementBase::Block2: detail::MatSandwichS<MomentElementBase::Block2>(M, S, scratch); break;
+    case MomentElementBase::Block4: detail::MatSandwichS<MomentElementBase::Block4>(M, S, scratch); break;
+    default: MatSandwich(M, S, scratch);
+    }
+}
+
 void RotMat(const double dx, const double dy,
             const double theta_x, const double theta_y, const double theta_z,
             typename MomentElementBase::value_t &R);
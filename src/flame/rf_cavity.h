@@ -3,6 +3,9 @@
 
 #endif // RF_CAVITY_H
 
+#include <list>
+#include <utility>
+
 #include <boost/numeric/ublas/matrix.hpp>
 
 #include "flame/moment.h"
@@ -59,42 +62,98 @@ struct ElementRFCavity : public MomentElementBase
         // vector Tfit and Sfit always have ten elements
         std::vector<double> Tfit, Sfit;
     };
-    std::vector<RawParams> lattice; // from thinlenlon_*.txt
+    //! Pre-processed field map, with transit time factors tabulated as a function of IonK.
+    //! Held by cavity_model, so shared by all elements using the same cavity data files.
+    struct ttf_table;
 
-    numeric_table mlptable, // from CaviMlp_*.txt
-                  CavData; // from axisData_*.txt
+    //! Data read from the files of one cavity type, or from one Generic cavity data file.
+    //! Immutable once loaded, and shared through data_file_cache by all elements using the same files.
+    struct cavity_model {
+        std::vector<RawParams> lattice; // from thinlenlon_*.txt, or elements of a Generic file
 
-    std::string CavType,
-                DataPath,
-                DataFile;
+        // read-only, shared with numeric_table_cache
+        numeric_table_cache::table_pointer mlptable, // from CaviMlp_*.txt
+                                           CavData; // from axisData_*.txt, or Ez of a Generic file
 
-    std::vector<double> SynAccTab;
+        std::shared_ptr<ttf_table> CavTTF; // for CavData
+        std::vector<std::shared_ptr<ttf_table> > MlpTTF; // for mlptable, indexed by column
 
-    bool have_RefNrm,
-         have_SynComplex,
-         have_EkLim,
-         have_NrLim;
+        std::vector<double> SynAccTab;
 
-    double RefNrm; // Reference scale factor q0*1.0/m0
+        bool have_Rm,
+             have_RefNrm,
+             have_SynComplex,
+             have_EkLim,
+             have_NrLim;
 
-    std::vector<double> SynComplex, // Fitting model coefficients
-                        EkLim,      // Limits for incident energy
-                        NrLim;      // Limits for normalization factor q*scl/m
+        double Rm,
+               RefNrm; // Reference scale factor q0*1.0/m0
+
+        std::vector<double> SynComplex, // Fitting model coefficients
+                            EkLim,      // Limits for incident energy
+                            NrLim;      // Limits for normalization factor q*scl/m
+
+        cavity_model()
+            :have_Rm(false), have_RefNrm(false), have_SynComplex(false), have_EkLim(false), have_NrLim(false)
+            ,Rm(0.0), RefNrm(0.0)
+        {}
+
+        void load(const std::string& cavfile, const std::string& fldmap, const std::string& mlpfile);
+        void load_generic(const std::string& DataFile);
+    };
+    std::shared_ptr<const cavity_model> model;
+
+    std::string CavType,
+                DataPath,
+                DataFile;
 
     double calFitPow(double kfac, const std::vector<double>& Tfit) const;
-    static std::map<std::string,std::shared_ptr<Config> > CavConfMap;
+    //! Evaluate the T and S fits of one thin lens element together
+    void calFitPow(double kfac, const std::vector<double>& Tfit, const std::vector<double>& Sfit,
+                   double& T, double& S) const;
 
-    std::vector<CavTLMLineType> CavTLMLineTab; // from lattice, for each charge state
     double fRF,    // RF frequency [Hz]
            IonFys, // Synchrotron phase [rad].
-           phi_ref,
-           cRm;
+           cRm,
+           SclFac, // Electric field scale factor.
+           SyncFlag;
     int cavi;
     bool forcettfcalc;
 
     unsigned MpoleLevel,
              EmitGrowth;
 
+    struct rfcache_t : public cache_t
+    {
+        rfcache_t() :phi_ref(std::numeric_limits<double>::quiet_NaN()) {}
+        virtual ~rfcache_t() {}
+
+        std::vector<CavTLMLineType> CavTLMLineTab; // from lattice, for each charge state
+        double phi_ref;
+        //! misalign[] and misalign_inv[] from which the (backward) transfer_inv[] was computed
+        std::vector<std::pair<value_t, value_t> > inv_misalign;
+
+        //! Results for recently seen input states other than last_*_in.  Most recently used first.
+        struct memo_t {
+            Particle last_ref_in, last_ref_out;
+            std::vector<Particle> last_real_in, last_real_out;
+            size_t last_tag_in, last_tag_out;
+            std::vector<value_t> transfer, misalign, misalign_inv;
+            std::vector<CavTLMLineType> CavTLMLineTab;
+            double phi_ref;
+        };
+        std::list<memo_t> memo;
+        //! Maximum # of entries in memo
+        enum {memo_size = 8};
+    };
+
+    //! Restore the results for an input state from rfcache_t::memo.
+    //! Otherwise save the current results to the memo before they are re-computed.
+    //! @returns true if ST was found
+    bool recall(const state_t& ST, rfcache_t& C) const;
+
+    virtual Cache* allocCache() const override final { return new rfcache_t; }
+
     ElementRFCavity(const Config& c);
 
     void LoadCavityFile(const Config& c);
@@ -118,12 +177,12 @@ struct ElementRFCavity : public MomentElementBase
 
     void PropagateLongRFCav(Particle &ref, double &phi_ref) const;
 
-    void calRFcaviEmitGrowth(const state_t::matrix_t &matIn, Particle &state, const int n,
+    void calRFcaviEmitGrowth(const rfcache_t &C, const state_t::matrix_t &matIn, Particle &state, const int n,
                              const double betaf, const double gamaf,
                              const double aveX2i, const double cenX, const double aveY2i, const double cenY,
-                             state_t::matrix_t &matOut);
+                             state_t::matrix_t &matOut) const;
 
-    void InitRFCav(Particle &real, state_t::matrix_t &M, CavTLMLineType &linetab);
+    void InitRFCav(Particle &real, const double phi_ref, state_t::matrix_t &M, CavTLMLineType &linetab) const;
 
     void GetCavBoost(const numeric_table &CavData, Particle &state, const double IonFy0,
                      const double EfieldScl, double &IonFy) const;
@@ -131,8 +190,18 @@ struct ElementRFCavity : public MomentElementBase
     void TransFacts(const int cavilabel, double beta, const double CaviIonK, const int gaplabel, const double EfieldScl,
                     double &Ecen, double &T, double &Tp, double &S, double &Sp, double &V0) const;
 
+    //! Argument of the polynomial fits of transit time factors, with its powers.
+    //! Computed once and shared by all of the fits evaluated at the same point.
+    struct fit_arg {
+        explicit fit_arg(double x);
+        double x,
+               p[10]; // p[k] = pow(x, k)
+    };
+
     void TransitFacMultipole(const int cavi, const std::string &flabel, const double CaviIonK,
                              double &T, double &S) const;
+    void TransitFacMultipole(const int cavi, const std::string &flabel, const fit_arg& CaviIonK,
+                             double &T, double &S) const;
 
     virtual ~ElementRFCavity() {}
 
@@ -140,16 +209,18 @@ struct ElementRFCavity : public MomentElementBase
         base_t::assign(other);
         const self_t* O=static_cast<const self_t*>(other);
         // *all* member variables must be assigned here or reconfigure() will result in inconsistancy
-        lattice       = O->lattice;
-        mlptable      = O->mlptable;
-        CavData       = O->CavData;
-        CavTLMLineTab = O->CavTLMLineTab;
+        // caches are discarded by ElementVoid::assign()
+        model         = O->model;
+        CavType       = O->CavType;
+        DataPath      = O->DataPath;
+        DataFile      = O->DataFile;
         fRF           = O->fRF;
         IonFys        = O->IonFys;
-        phi_ref       = O->phi_ref;
         MpoleLevel    = O->MpoleLevel;
         EmitGrowth    = O->EmitGrowth;
         cRm           = O->cRm;
+        SclFac        = O->SclFac;
+        SyncFlag      = O->SyncFlag;
         cavi          = O->cavi;
         forcettfcalc  = O->forcettfcalc;
     }
@@ -157,6 +228,7 @@ struct ElementRFCavity : public MomentElementBase
     virtual void advance(StateBase& s) override final
     {
         state_t&  ST = static_cast<state_t&>(s);
+        rfcache_t& C = cache<rfcache_t>(s);
         using namespace boost::numeric::ublas;
 
         double x0[2], x2[2], s0[2];
@@ -164,65 +236,59 @@ struct ElementRFCavity : public MomentElementBase
         // IonEk is Es + E_state; the latter is set by user.
         ST.recalc();
 
-        if(!check_cache(ST) && !ST.retreat) {
-            last_ref_in = ST.ref;
-            last_real_in = ST.real;
-            resize_cache(ST);
+        // last_real_out is cleared while results are being computed
+        if(!ST.retreat && !(check_cache(ST, C) && C.last_real_out.size()==ST.size()) && !recall(ST, C)) {
+            C.last_ref_in = ST.ref;
+            C.last_real_in = ST.real;
+            C.last_tag_in = ST.particle_tag;
+            C.last_real_out.clear();
+            resize_cache(ST, C);
             // need to re-calculate energy dependent terms
+            // (cavity data for a changed "cavtype" or "datafile" is loaded by reconfigure())
 
-            std::string newtype = conf().get<std::string>("cavtype");
-            if (CavType != newtype){
-                lattice.clear();
-                SynAccTab.clear();
-                LoadCavityFile(conf());
-            } else if (CavType == "Generic") {
-                std::string newfile = conf().get<std::string>("Eng_Data_Dir", defpath);
-                newfile += "/" + conf().get<std::string>("datafile");
-                if (DataFile != newfile) {
-                    lattice.clear();
-                    SynAccTab.clear();
-                    LoadCavityFile(conf());
-                }
-            }
-
-            recompute_matrix(ST); // updates transfer and last_Kenergy_out
+            recompute_matrix(ST, C); // updates transfer and last_Kenergy_out
 
-            for(size_t i=0; i<last_real_in.size(); i++)
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
+            for(size_t i=0; i<C.last_real_in.size(); i++)
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
 
             ST.recalc();
 
-            last_ref_out = ST.ref;
-            last_real_out = ST.real;
+            ST.touch_particles();
+            C.last_ref_out = ST.ref;
+            C.last_real_out = ST.real;
+            C.last_tag_out = ST.particle_tag;
         } else if(ST.retreat){
-            if (!check_backward(ST))
+            if (!check_backward(ST, C))
                 throw std::runtime_error(SB()<<
                     "Backward propagation error at " << ST.next_elem << ": beam state does not match to the previous propagation.");
 
-            ST.ref.phis -= (last_ref_out.phis - last_ref_in.phis);
-            ST.ref.IonEk = last_ref_in.IonEk;
-            for(size_t k=0; k<last_real_in.size(); k++) {
-                ST.real[k].phis -= (last_real_out[k].phis - last_real_in[k].phis);
-                ST.real[k].IonEk = last_real_in[k].IonEk;
-                get_misalign(ST, ST.real[k], misalign[k], misalign_inv[k]);
+            ST.ref.phis -= (C.last_ref_out.phis - C.last_ref_in.phis);
+            ST.ref.IonEk = C.last_ref_in.IonEk;
+            for(size_t k=0; k<C.last_real_in.size(); k++) {
+                ST.real[k].phis -= (C.last_real_out[k].phis - C.last_real_in[k].phis);
+                ST.real[k].IonEk = C.last_real_in[k].IonEk;
+                get_misalign(ST, ST.real[k], C.misalign[k], C.misalign_inv[k]);
             }
 
             ST.recalc();
+            ST.touch_particles();
 
         } else {
-            ST.ref = last_ref_out;
-            assert(last_real_out.size()==ST.real.size()); // should be true if check_cache() -> true
-            std::copy(last_real_out.begin(),
-                      last_real_out.end(),
+            ST.ref = C.last_ref_out;
+            assert(C.last_real_out.size()==ST.real.size()); // should be true if check_cache() -> true
+            std::copy(C.last_real_out.begin(),
+                      C.last_real_out.end(),
                       ST.real.begin());
+            ST.particle_tag = C.last_tag_out;
         }
         // note that calRFcaviEmitGrowth() assumes real[] isn't changed after this point
 
         if(!ST.retreat){
             // Forward propagation
             ST.pos += length;
-            for(size_t i=0; i<last_real_in.size(); i++) {
-                ST.moment0[i] = prod(misalign[i], ST.moment0[i]);
+            C.transfer_inv.clear(); // centroid terms of 'transfer' are updated below
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
+                MatVecMult(C.misalign[i], ST.moment0[i]);
 
                 // Inconsistency in TLM; orbit at entrace should be used to evaluate emittance growth.
                 x0[0]  = ST.moment0[i][state_t::PS_X];
@@ -231,82 +297,93 @@ struct ElementRFCavity : public MomentElementBase
                 x2[1]  = ST.moment1[i](2, 2);
 
                 // reset extra parameters in transfer matrix
-                transfer[i](state_t::PS_S, 6) = 0.0;
-                transfer[i](state_t::PS_PS, 6) = 0.0;
+                C.transfer[i](state_t::PS_S, 6) = 0.0;
+                C.transfer[i](state_t::PS_PS, 6) = 0.0;
 
-                ST.moment0[i] = prod(transfer[i], ST.moment0[i]);
+                MatVecMult(C.transfer[i], ST.moment0[i]);
 
                 // combine new z and zp centroid to transfer matrix for backward propagation
                 s0[0] = (ST.real[i].phis - ST.ref.phis);
                 s0[1] = (ST.real[i].IonEk - ST.ref.IonEk)/MeVtoeV;
-                transfer[i](state_t::PS_S, 6) = - ST.moment0[i][state_t::PS_S] + s0[0];
-                transfer[i](state_t::PS_PS, 6) = - ST.moment0[i][state_t::PS_PS] + s0[1];
+                C.transfer[i](state_t::PS_S, 6) = - ST.moment0[i][state_t::PS_S] + s0[0];
+                C.transfer[i](state_t::PS_PS, 6) = - ST.moment0[i][state_t::PS_PS] + s0[1];
 
                 // insert new z and zp centroid
                 ST.moment0[i][state_t::PS_S]  = s0[0];
                 ST.moment0[i][state_t::PS_PS] = s0[1];
 
-                ST.moment0[i] = prod(misalign_inv[i], ST.moment0[i]);
-
-                scratch = prod(misalign[i], ST.moment1[i]);
-                ST.moment1[i] = prod(scratch, trans(misalign[i]));
+                MatVecMult(C.misalign_inv[i], ST.moment0[i]);
 
-                scratch = prod(transfer[i], ST.moment1[i]);
-                ST.moment1[i] = prod(scratch, trans(transfer[i]));
+                MatSandwich(C.misalign[i], ST.moment1[i], C.scratch);
+                MatSandwich(C.transfer[i], ST.moment1[i], C.scratch);
 
                 if (EmitGrowth) {
-                    calRFcaviEmitGrowth(ST.moment1[i], ST.ref, i, ST.real[i].beta, ST.real[i].gamma, x2[0], x0[0], x2[1], x0[1], scratch);
-                    ST.moment1[i] = scratch;
+                    calRFcaviEmitGrowth(C, ST.moment1[i], ST.ref, i, ST.real[i].beta, ST.real[i].gamma, x2[0], x0[0], x2[1], x0[1], C.scratch);
+                    ST.moment1[i] = C.scratch;
                 }
 
-                scratch = prod(misalign_inv[i], ST.moment1[i]);
-                ST.moment1[i] = prod(scratch, trans(misalign_inv[i]));
+                MatSandwich(C.misalign_inv[i], ST.moment1[i], C.scratch);
 
-                scratch = prod(transfer[i], misalign[i]);
-                scratch = prod(misalign_inv[i], scratch);
-                ST.transmat[i] = scratch;
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, ST.transmat[i]);
             }
         } else {
             // Backward propagation
             ST.pos -= length;
-            value_t invmat = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-            for(size_t i=0; i<last_real_in.size(); i++) {
-                scratch = prod(transfer[i], misalign[i]);
-                scratch = prod(misalign_inv[i], scratch);
+            if(C.transfer_inv.size()!=C.last_real_in.size()) {
+                C.transfer_inv.resize(C.last_real_in.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+                C.inv_misalign.clear();
+            }
+            C.inv_misalign.resize(C.last_real_in.size());
+
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
+                // misalign[] was just re-computed from the incoming state
+                if(MatEqual(C.inv_misalign[i].first, C.misalign[i])
+                        && MatEqual(C.inv_misalign[i].second, C.misalign_inv[i]))
+                    continue;
 
-                inverse(invmat, scratch);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMultLeft(C.misalign_inv[i], C.scratch);
+
+                inverse(C.transfer_inv[i], C.scratch);
+
+                C.inv_misalign[i].first = C.misalign[i];
+                C.inv_misalign[i].second = C.misalign_inv[i];
+            }
 
-                ST.moment0[i] = prod(invmat, ST.moment0[i]);
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
+                const value_t& invmat = C.transfer_inv[i];
 
-                scratch  = prod(invmat, ST.moment1[i]);
-                ST.moment1[i] = prod(scratch, trans(invmat));
+                MatVecMult(invmat, ST.moment0[i]);
+                MatSandwich(invmat, ST.moment1[i], C.scratch);
                 ST.transmat[i] = invmat;
             }
 
         }
 
-        ST.last_caviphi0 = fmod(phi_ref*180e0/M_PI, 360e0); // driven phase [degree]
-        ST.calc_rms();
+        ST.last_caviphi0 = fmod(C.phi_ref*180e0/M_PI, 360e0); // driven phase [degree]
+        ST.invalidate_rms();
     }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& BC) const override final
     {
         // Re-initialize transport matrix. and update ST.ref and ST.real[]
+        rfcache_t& C = static_cast<rfcache_t&>(BC);
 
-        CavTLMLineTab.resize(last_real_in.size());
+        C.CavTLMLineTab.resize(C.last_real_in.size());
 
-        PropagateLongRFCav(ST.ref, phi_ref);
+        PropagateLongRFCav(ST.ref, C.phi_ref);
 
-        for(size_t i=0; i<last_real_in.size(); i++) {
+        for(size_t i=0; i<C.last_real_in.size(); i++) {
             // TODO: 'transfer' is overwritten in InitRFCav()?
-            transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-            transfer[i](state_t::PS_X, state_t::PS_PX) = length;
-            transfer[i](state_t::PS_Y, state_t::PS_PY) = length;
+            C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+            C.transfer[i](state_t::PS_X, state_t::PS_PX) = length;
+            C.transfer[i](state_t::PS_Y, state_t::PS_PY) = length;
 
             // J.B. Bug in TLM.
             double SampleIonK = ST.real[i].SampleIonK;
 
-            InitRFCav(ST.real[i], transfer[i], CavTLMLineTab[i]);
+            InitRFCav(ST.real[i], C.phi_ref, C.transfer[i], C.CavTLMLineTab[i]);
 
             // J.B. Bug in TLM.
             ST.real[i].SampleIonK = SampleIonK;
@@ -39,9 +39,10 @@ void yyerror (yacc_arg arg, const char* msg)
 
 %union { vector_t *vector; }
 %destructor { glps_vector_cleanup($$); } <vector>
+%token <vector> NUMVEC
 %type <vector> expr_list vector
 
-%printer { fprintf(yyoutput, "%p", (void *)$$); } expr_list vector;
+%printer { fprintf(yyoutput, "%p", (void *)$$); } NUMVEC expr_list vector;
 
 %union { kvlist_t *kvlist; }
 %destructor { glps_kvlist_cleanup($$); } <kvlist>
@@ -80,7 +81,7 @@ void yyerror (yacc_arg arg, const char* msg)
 %%
 
 file : %empty
-     | entry file
+     | file entry
 
 entry : assignment
       | element
@@ -124,3 +125,4 @@ expr_list : %empty             { $$ = NULL; }
           | expr ',' expr_list { $$ = glps_append_vector(ctxt, $3, $1); PERR($$); }
 
 vector : '[' expr_list ']'  { $$ = $2; }
+       | NUMVEC             { $$ = $1; }
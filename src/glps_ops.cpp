@@ -149,6 +149,7 @@ int unary_parse(parse_context* ctxt, expr_value_t *R, const expr_t * const *A)
 
     std::shared_ptr<Config> ret(P.parse_file(name.string().c_str()));
     *R = ret;
+    ctxt->cacheable = false;
     return 0;
 }
 
@@ -166,6 +167,7 @@ int unary_file(parse_context* ctxt, expr_value_t *R, const expr_t * const *A)
         return 1;
     }
 
+    ctxt->resolved.push_back(std::make_pair(inp, ret.string()));
     *R = ret.string();
     return 0;
 }
@@ -190,7 +192,9 @@ int unary_h5file(parse_context* ctxt, expr_value_t *R, const expr_t * const *A)
         path fname(absolute(inp.substr(0, sep), ctxt->cwd));
 
         if(exists(fname)) {
-            *R = canonical(fname).string() + inp.substr(sep);
+            const std::string fpath(canonical(fname).string());
+            ctxt->resolved.push_back(std::make_pair(fname.string(), fpath));
+            *R = fpath + inp.substr(sep);
             return 0;
         } else if(sep==inp.npos) {
             break;
@@ -207,7 +211,7 @@ int unary_h5file(parse_context* ctxt, expr_value_t *R, const expr_t * const *A)
 } // namespace
 
 parse_context::parse_context(const char *path)
-    :last_line(0), printer(NULL), error_scratch(300), scanner(NULL)
+    :last_line(0), printer(NULL), error_scratch(300), cacheable(true), scanner(NULL)
 {
     if(path)
         cwd = std::filesystem::canonical(path);
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <memory>
 #include <iterator>
 #include <stdexcept>
@@ -215,6 +216,43 @@ vector_t* glps_append_vector(parse_context *ctxt, vector_t *list, expr_t *expr)
     }
 }
 
+vector_t* glps_vector_parse(parse_context *ctxt, const char *s, size_t len)
+{
+    // s is a complete numeric vector literal as matched by the lexer, eg. "[1, -2.5e3]"
+    assert(len>=2 && s[0]=='[' && s[len-1]==']');
+    try{
+        std::unique_ptr<vector_t> V(new vector_t);
+        const char *pos = s+1, * const end = s+len-1;
+
+        V->value.reserve(std::count(pos, end, ',')+1);
+
+        while(true) {
+            while(pos!=end && (*pos==' ' || *pos=='\t' || *pos=='\n' || *pos==','))
+                pos++;
+            if(pos==end)
+                break;
+
+            double val;
+            std::from_chars_result R = std::from_chars(pos, end, val);
+            if(R.ec==std::errc::result_out_of_range) {
+                glps_error(ctxt->scanner, ctxt, "Invalid numeric constant '%s'", std::string(pos, R.ptr).c_str());
+                return NULL;
+            } else if(R.ec!=std::errc()) {
+                throw std::logic_error("lexer passed invalid number");
+            }
+            V->value.push_back(val);
+            pos = R.ptr;
+        }
+
+        // match the order built by glps_append_vector()
+        std::reverse(V->value.begin(), V->value.end());
+        return V.release();
+    } catch(std::exception& e) {
+        glps_error(ctxt->scanner, ctxt, "Error parsing vector: %s", e.what());
+        return NULL;
+    }
+}
+
 expr_t *glps_add_value(parse_context *ctxt, glps_expr_type t, ...)
 {
     std::unique_ptr<expr_t> ret;
@@ -286,7 +324,7 @@ expr_t *glps_add_value(parse_context *ctxt, glps_expr_type t, ...)
                 ret->value = std::vector<double>();
             else {
                 std::reverse(vec->value.begin(), vec->value.end());
-                ret->value = vec->value;
+                ret->value = std::move(vec->value);
                 delete vec;
             }
             break;
@@ -494,7 +532,10 @@ void glps_call1(parse_context *ctxt, string_t *func, expr_t *arg)
 
     if(func->str!="print") {
         glps_error(ctxt->scanner, ctxt, "Undefined global function '%s'", func->str.c_str());
-    } else if(ctxt->printer) {
+        return;
+    }
+    ctxt->cacheable = false;
+    if(ctxt->printer) {
         std::ostream& strm = *ctxt->printer;
         strm<<"On line "<<glps_get_lineno(ctxt->scanner)<<" : ";
         switch(arg->etype)
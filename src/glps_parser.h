@@ -71,6 +71,7 @@ void glps_call1(parse_context*, string_t*, expr_t*);
 kvlist_t* glps_append_kv(parse_context *ctxt, kvlist_t*, kv_t*);
 strlist_t* glps_append_expr(parse_context *ctxt, strlist_t*, expr_t *);
 vector_t* glps_append_vector(parse_context *ctxt, vector_t*, expr_t *);
+vector_t* glps_vector_parse(parse_context *ctxt, const char *, size_t);
 
 expr_t *glps_add_value(parse_context *ctxt, glps_expr_type t, ...);
 expr_t *glps_add_op(parse_context *ctxt, string_t *, unsigned N, expr_t **);
@@ -193,6 +194,13 @@ struct parse_context {
 
     std::vector<char> error_scratch;
 
+    //! Cleared if the result depends on more than the input text (eg. parse() of another file)
+    //! or if parsing has side-effects (eg. print()), so must not be cached.
+    bool cacheable;
+    //! Paths expanded by file(), dir() and h5file(), as (argument to canonical(), result).
+    //! A cached result is only re-used while each argument still expands to the same path.
+    std::vector<std::pair<std::string, std::string> > resolved;
+
     //! Directory containing the file being parsed, or process CWD
     //! when parsing a string.
     //! Used to expand relative paths
@@ -1,5 +1,6 @@
 
 #include <fstream>
+#include <atomic>
 
 #include <limits>
 
@@ -48,6 +49,9 @@ bool load_storage(ARR& to, const Config& conf, const std::string& name, bool T=t
     }
 }
 
+// source of MomentState::particle_tag.  Zero is never used
+std::atomic<size_t> next_particle_tag(1);
+
 } // namespace
 
 std::ostream& operator<<(std::ostream& strm, const Particle& P)
@@ -74,6 +78,8 @@ MomentState::MomentState(const Config& c)
     ,moment0_env(maxsize, 0e0)
     ,moment0_rms(maxsize, 0e0)
     ,moment1_env(boost::numeric::ublas::identity_matrix<double>(maxsize))
+    ,particle_tag(0)
+    ,rms_valid(false)
 {
     // hack.  getArray() promises that returned pointers will remain valid for our lifetime.
     // This may not be true if std::vectors are resized.
@@ -187,7 +193,9 @@ MomentState::MomentState(const Config& c)
         moment1.resize(1);
         transmat.resize(1);
         moment0[0].resize(maxsize);
+        moment0[0] = boost::numeric::ublas::zero_vector<double>(maxsize);
         moment1[0].resize(maxsize, maxsize);
+        moment1[0] = boost::numeric::ublas::identity_matrix<double>(maxsize);
         transmat[0].resize(maxsize, maxsize);
 
         load_storage(moment0[0].data(), c, vectorname, false);
@@ -196,12 +204,18 @@ MomentState::MomentState(const Config& c)
     }
 
     last_caviphi0 = 0e0;
+    touch_particles();
     calc_rms();
 }
 
 MomentState::~MomentState() {}
 
-void MomentState::calc_rms()
+void MomentState::touch_particles()
+{
+    particle_tag = next_particle_tag.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MomentState::calc_rms() const
 {
     assert(real.size()>0);
     assert(moment0_env.size()==maxsize);
@@ -233,6 +247,7 @@ void MomentState::calc_rms()
     for(size_t j=0; j<maxsize; j++) {
         moment0_rms[j] = sqrt(moment1_env(j,j));
     }
+    rms_valid = true;
 }
 
 MomentState::MomentState(const MomentState& o, clone_tag t)
@@ -246,6 +261,8 @@ MomentState::MomentState(const MomentState& o, clone_tag t)
     ,moment0_rms(o.moment0_rms)
     ,moment1_env(o.moment1_env)
     ,last_caviphi0(o.last_caviphi0)
+    ,particle_tag(o.particle_tag)
+    ,rms_valid(o.rms_valid)
 {}
 
 void MomentState::assign(const StateBase& other)
@@ -262,6 +279,8 @@ void MomentState::assign(const StateBase& other)
     moment0_rms = O->moment0_rms;
     moment1_env = O->moment1_env;
     last_caviphi0 = O->last_caviphi0;
+    particle_tag = O->particle_tag;
+    rms_valid = O->rms_valid;
     StateBase::assign(other);
 }
 
@@ -272,6 +291,8 @@ void MomentState::show(std::ostream& strm, int level) const
         return;
     }
 
+    update_rms();
+
     if(level<=0) {
         strm<<"State: moment0 mean="<<moment0_env;
     }
@@ -309,6 +330,7 @@ void MomentState::show(std::ostream& strm, int level) const
 bool MomentState::getArray(unsigned idx, ArrayInfo& Info) {
     unsigned I=0;
     if(idx==I++) {
+        update_rms();
         Info.name = "moment1_env";
         Info.ptr = &moment1_env(0,0);
         Info.type = ArrayInfo::Double;
@@ -354,6 +376,7 @@ bool MomentState::getArray(unsigned idx, ArrayInfo& Info) {
         Info.stride[2] = sizeof(transmat[0]);
         return true;
     } else if(idx==I++) {
+        update_rms();
         Info.name = "moment0_env";
         Info.ptr = &moment0_env(0);
         Info.type = ArrayInfo::Double;
@@ -362,6 +385,7 @@ bool MomentState::getArray(unsigned idx, ArrayInfo& Info) {
         Info.stride[0] = sizeof(double);
         return true;
     } else if(idx==I++) {
+        update_rms();
         Info.name = "moment0_rms";
         Info.ptr = &moment0_rms(0);
         Info.type = ArrayInfo::Double;
@@ -557,22 +581,24 @@ MomentElementBase::MomentElementBase(const Config& c)
     ,yaw  (c.get<double>("yaw",   0e0))
     ,roll (c.get<double>("roll",  0e0))
     ,skipcache(c.get<double>("skipcache", 0.0)!=0.0)
-    ,scratch(state_t::maxsize, state_t::maxsize)
 {
+    update_misalign();
 }
 
 MomentElementBase::~MomentElementBase() {}
 
+MomentElementBase::cache_t::cache_t()
+    :last_tag_in(0)
+    ,last_tag_out(0)
+    ,scratch(state_t::maxsize, state_t::maxsize)
+{}
+
+MomentElementBase::cache_t::~cache_t() {}
+
 void MomentElementBase::assign(const ElementVoid *other)
 {
     const MomentElementBase *O = static_cast<const MomentElementBase*>(other);
-    last_real_in = O->last_real_in;
-    last_real_out= O->last_real_out;
-    last_ref_in  = O->last_ref_in;
-    last_ref_out = O->last_ref_out;
-    transfer = O->transfer;
-    misalign = O->misalign;
-    misalign_inv = O->misalign_inv;
+    // caches are discarded by ElementVoid::assign()
     dx = O->dx;
     dy = O->dy;
     pitch = O->pitch;
@@ -580,6 +606,7 @@ void MomentElementBase::assign(const ElementVoid *other)
     roll  = O->roll;
     skipcache = O->skipcache;
     ElementVoid::assign(other);
+    update_misalign(); // after 'length' is assigned
 }
 
 void MomentElementBase::show(std::ostream& strm, int level) const
@@ -593,158 +620,272 @@ void MomentElementBase::show(std::ostream& strm, int level) const
           */
 }
 
-void MomentElementBase::get_misalign(const state_t &ST, const Particle &real, value_t &M, value_t &IM) const
+void MomentElementBase::update_misalign()
 {
-    state_t::matrix_t R,
-              scl     = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize),
-              scl_inv = scl,
-              T       = scl,
-              T_inv   = scl,
-              R_inv   = scl;
-
-    scl(state_t::PS_S, state_t::PS_S)   /= -real.SampleIonK;
-    scl(state_t::PS_PS, state_t::PS_PS) /= sqr(real.beta)*real.gamma*ST.ref.IonEs/MeVtoeV;
+    typedef boost::numeric::ublas::identity_matrix<double> ident_t;
+    enum {N=state_t::maxsize};
 
-    inverse(scl_inv, scl);
+    misalign_geom = misalign_geom_inv = ident_t(N);
+    if(dx==0e0 && dy==0e0 && pitch==0e0 && yaw==0e0 && roll==0e0)
+        return;
 
-    // Translate to center of element.
-    T(state_t::PS_S,  6) = -length/2e0*MtoMM;
-    T(state_t::PS_PS, 6) = 1e0;
-    inverse(T_inv, T);
+    state_t::matrix_t R, R_inv = ident_t(N), T = ident_t(N), T_inv = ident_t(N);
 
     RotMat(dx, dy, pitch, yaw, roll, R);
 
-    M = prod(T, scl);
-    M = prod(R, M);
-    M = prod(T_inv, M);
-    M = prod(scl_inv, M);
-
+    // Only done when an element is (re)configured, so the general inverse is cheap enough.
     inverse(R_inv, R);
 
     // Translate to center of element.
-    T(state_t::PS_S,  6) = length/2e0*MtoMM;
-    T(state_t::PS_PS, 6) = 1e0;
-    inverse(T_inv, T);
-
-    IM = prod(T, scl);
-    IM = prod(R_inv, IM);
-    IM = prod(T_inv, IM);
-    IM = prod(scl_inv, IM);
+    T(state_t::PS_S,  6)     = -length/2e0*MtoMM;
+    T(state_t::PS_PS, 6)     =  1e0;
+    T_inv(state_t::PS_S,  6) =  length/2e0*MtoMM;
+    T_inv(state_t::PS_PS, 6) = -1e0;
+
+    // misalign_geom = T_inv*R*T
+    MatMult(R, T, misalign_geom);
+    MatMultLeft(T_inv, misalign_geom);
+
+    // Translate to center of element.
+    T(state_t::PS_S,  6)     =  length/2e0*MtoMM;
+    T(state_t::PS_PS, 6)     =  1e0;
+    T_inv(state_t::PS_S,  6) = -length/2e0*MtoMM;
+    T_inv(state_t::PS_PS, 6) = -1e0;
+
+    // misalign_geom_inv = T_inv*R_inv*T
+    MatMult(R_inv, T, misalign_geom_inv);
+    MatMultLeft(T_inv, misalign_geom_inv);
 }
 
-unsigned MomentElementBase::get_flag(const Config& c, const std::string& name, const unsigned& def_value)
+void MomentElementBase::get_misalign(const state_t &ST, const Particle &real, value_t &M, value_t &IM) const
 {
-    unsigned read_value;
-    double check_value;
-
-    try {
-        check_value = boost::lexical_cast<double>(c.get<std::string>(name));
-    }catch (std::exception&){
-        try {
-            check_value = c.get<double>(name);
-        }catch (std::exception&){
-            check_value = boost::lexical_cast<double>(def_value);
+    enum {N=state_t::maxsize};
+
+    // M = inv(scl)*misalign_geom*scl, where scl is diagonal,
+    // and only differs from identity for the longitudinal coordinates.
+    double scl[N], scl_inv[N];
+    for(unsigned i=0; i<N; i++)
+        scl[i] = 1e0;
+    scl[state_t::PS_S]  /= -real.SampleIonK;
+    scl[state_t::PS_PS] /= sqr(real.beta)*real.gamma*ST.ref.IonEs/MeVtoeV;
+    for(unsigned i=0; i<N; i++)
+        scl_inv[i] = 1e0/scl[i];
+
+    M.resize(N, N, false);
+    IM.resize(N, N, false);
+    for(unsigned i=0; i<N; i++) {
+        for(unsigned j=0; j<N; j++) {
+            M(i, j)  = scl_inv[i]*(misalign_geom(i, j)*scl[j]);
+            IM(i, j) = scl_inv[i]*(misalign_geom_inv(i, j)*scl[j]);
         }
     }
+}
+
+unsigned MomentElementBase::get_flag(const Config& c, const std::string& name, const unsigned& def_value) const
+{
+    double check_value = def_value;
+    std::string str_value;
+
+    if(c.tryGet<std::string>(name, str_value)) {
+        if(!boost::conversion::try_lexical_convert(str_value, check_value))
+            check_value = def_value;
+    } else if(!c.tryGet<double>(name, check_value)) {
+        check_value = def_value;
+    }
 
     //Check the value is an unsigned integer
-    try {
-        read_value = boost::lexical_cast<unsigned>(check_value);
-        if (boost::lexical_cast<double>(read_value) != check_value)
-            throw std::runtime_error(SB()<< name << " must be an unsigned integer");
-    }catch (std::exception&){
+    if(!(check_value>=0e0 && check_value<=double(std::numeric_limits<unsigned>::max()) && check_value==std::floor(check_value)))
         throw  std::runtime_error(SB()<< name << " must be an unsigned integer");
-    }
-    return read_value;
+
+    return unsigned(check_value);
 }
 
 void MomentElementBase::advance(StateBase& s)
 {
     state_t&  ST = static_cast<state_t&>(s);
+    cache_t&  C = cache<cache_t>(s);
     using namespace boost::numeric::ublas;
 
     // IonEk is Es + E_state; the latter is set by user.
     ST.recalc();
 
-    if(!check_cache(ST)){
+    if(!check_cache(ST, C)){
         // need to re-calculate energy dependent terms
-        last_ref_in = ST.ref;
-        last_real_in = ST.real;
-        resize_cache(ST);
+        C.last_ref_in = ST.ref;
+        C.last_real_in = ST.real;
+        C.last_tag_in = ST.particle_tag;
+        resize_cache(ST, C);
+
+        recompute_matrix(ST, C); // updates transfer and last_Kenergy_out
 
-        recompute_matrix(ST); // updates transfer and last_Kenergy_out
+        for(size_t k=0; k<C.transfer.size(); k++)
+            C.sparsity[k] = MatSparsity(C.transfer[k]);
+        C.transfer_inv.clear();
 
         ST.recalc();
 
         if(!ST.retreat){
             ST.ref.phis += ST.ref.SampleIonK*length*MtoMM;
-            for(size_t k=0; k<last_real_in.size(); k++)
+            for(size_t k=0; k<C.last_real_in.size(); k++)
                 ST.real[k].phis += ST.real[k].SampleIonK*length*MtoMM;
         } else {
             ST.ref.phis -= ST.ref.SampleIonK*length*MtoMM;
-            for(size_t k=0; k<last_real_in.size(); k++)
+            for(size_t k=0; k<C.last_real_in.size(); k++)
                 ST.real[k].phis -= ST.real[k].SampleIonK*length*MtoMM;
         }
 
-        last_ref_out = ST.ref;
-        last_real_out = ST.real;
+        ST.touch_particles();
+        C.last_ref_out = ST.ref;
+        C.last_real_out = ST.real;
+        C.last_tag_out = ST.particle_tag;
     } else {
-        ST.ref = last_ref_out;
-        assert(last_real_out.size()==ST.real.size()); // should be true if check_cache() -> true
-        std::copy(last_real_out.begin(),
-                  last_real_out.end(),
+        ST.ref = C.last_ref_out;
+        assert(C.last_real_out.size()==ST.real.size()); // should be true if check_cache() -> true
+        std::copy(C.last_real_out.begin(),
+                  C.last_real_out.end(),
                   ST.real.begin());
+        ST.particle_tag = C.last_tag_out;
     }
 
     if(!ST.retreat){
         // Forward propagation
         ST.pos += length;
 
-        for(size_t k=0; k<last_real_in.size(); k++) {
-            ST.moment0[k] = prod(transfer[k], ST.moment0[k]);
+        for(size_t k=0; k<C.last_real_in.size(); k++) {
+            MatVecMult(C.transfer[k], ST.moment0[k], C.sparsity[k]);
+            MatSandwich(C.transfer[k], ST.moment1[k], C.scratch, C.sparsity[k]);
 
-            scratch = prod(transfer[k], ST.moment1[k]);
-            ST.moment1[k] = prod(scratch, trans(transfer[k]));
-
-            ST.transmat[k] = transfer[k];
+            ST.transmat[k] = C.transfer[k];
         }
     } else {
         // Backward propagation
         ST.pos -= length;
 
-        value_t invmat = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-        for(size_t k=0; k<last_real_in.size(); k++) {
-            inverse(invmat, transfer[k]);
+        if(C.transfer_inv.size()!=C.transfer.size()) {
+            C.transfer_inv.resize(C.transfer.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+            for(size_t k=0; k<C.transfer.size(); k++)
+                inverse(C.transfer_inv[k], C.transfer[k]);
+        }
 
-            ST.moment0[k] = prod(invmat, ST.moment0[k]);
+        for(size_t k=0; k<C.last_real_in.size(); k++) {
+            const value_t& invmat = C.transfer_inv[k];
 
-            scratch = prod(invmat, ST.moment1[k]);
-            ST.moment1[k] = prod(scratch, trans(invmat));
+            // LU decomposition preserves the block structure
+            MatVecMult(invmat, ST.moment0[k], C.sparsity[k]);
+            MatSandwich(invmat, ST.moment1[k], C.scratch, C.sparsity[k]);
 
             ST.transmat[k] = invmat;
         }
     }
 
-    ST.calc_rms();
+    ST.invalidate_rms();
 }
 
-bool MomentElementBase::check_cache(const state_t& ST) const
+size_t MomentElementBase::advance_run(StateBase& s, ElementVoid* const* elems, size_t count)
 {
-    return !skipcache
-            && last_real_in.size()==ST.size()
-            && last_ref_in==ST.ref
-            && std::equal(last_real_in.begin(),
-                          last_real_in.end(),
+    state_t&  ST = static_cast<state_t&>(s);
+
+    // elems[0, count) are runnable(), so MomentElementBase
+    const size_t N = count;
+    if(ST.retreat || N<2)
+        return 0;
+
+    cache_t&  C = cache<cache_t>(s);
+    cache_t::run_t& R = C.run;
+
+    ST.recalc();
+
+    bool valid = R.count!=0 && R.count<=N
+            && (R.tag_in==ST.particle_tag
+                || (R.real_in.size()==ST.size()
+                    && R.ref_in==ST.ref
+                    && std::equal(R.real_in.begin(),
+                                  R.real_in.end(),
+                                  ST.real.begin())));
+    for(size_t i=0; valid && i<R.count; i++)
+        valid = R.generation[i]==elems[i]->generation();
+
+    if(valid) {
+        ST.ref = R.ref_out;
+        std::copy(R.real_out.begin(),
+                  R.real_out.end(),
+                  ST.real.begin());
+        ST.particle_tag = R.tag_out;
+        ST.pos += R.length;
+
+        for(size_t k=0; k<R.real_in.size(); k++) {
+            MatVecMult(R.composite[k], ST.moment0[k], R.sparsity[k]);
+            MatSandwich(R.composite[k], ST.moment1[k], C.scratch, R.sparsity[k]);
+
+            ST.transmat[k] = R.transmat[k];
+        }
+
+        ST.invalidate_rms();
+        return R.count;
+    }
+
+    // Propagate element by element.  If every element re-uses its cached
+    // transfer matricies then remember their product for next time.
+    R.count = 0;
+    R.generation.clear();
+    R.ref_in = ST.ref;
+    R.real_in = ST.real;
+    R.tag_in = ST.particle_tag;
+    R.composite.assign(ST.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+    R.length = 0e0;
+
+    bool compose = true;
+    for(size_t i=0; i<N; i++) {
+        MomentElementBase *E = static_cast<MomentElementBase*>(elems[i]);
+        const cache_t& EC = E->cache<cache_t>(s);
+
+        compose &= E->check_cache(ST, EC);
+
+        E->advance(s);
+
+        if(compose) {
+            for(size_t k=0; k<R.composite.size(); k++)
+                MatMultLeft(EC.transfer[k], R.composite[k]);
+            R.generation.push_back(E->generation());
+            R.length += E->length;
+        }
+    }
+
+    if(compose) {
+        R.count = N;
+        R.ref_out = ST.ref;
+        R.real_out = ST.real;
+        R.tag_out = ST.particle_tag;
+        R.transmat = ST.transmat;
+        R.sparsity.resize(R.composite.size());
+        for(size_t k=0; k<R.composite.size(); k++)
+            R.sparsity[k] = MatSparsity(R.composite[k]);
+    }
+
+    return N;
+}
+
+bool MomentElementBase::check_cache(const state_t& ST, const cache_t& C) const
+{
+    if(skipcache)
+        return false;
+    if(C.last_tag_in!=0 && C.last_tag_in==ST.particle_tag)
+        return true;
+
+    return C.last_real_in.size()==ST.size()
+            && C.last_ref_in==ST.ref
+            && std::equal(C.last_real_in.begin(),
+                          C.last_real_in.end(),
                           ST.real.begin());
 }
 
-bool MomentElementBase::check_backward(const state_t& ST) const
+bool MomentElementBase::check_backward(const state_t& ST, const cache_t& C) const
 {
     bool reals = true;
-    if (last_real_out.size()==ST.size()) {
-        reals = last_ref_out<=ST.ref;
-        for(size_t k=0; k<last_real_out.size(); k++) {
-            reals &= last_real_out[k]<=ST.real[k];
+    if (C.last_real_out.size()==ST.size()) {
+        reals = C.last_ref_out<=ST.ref;
+        for(size_t k=0; k<C.last_real_out.size(); k++) {
+            reals &= C.last_real_out[k]<=ST.real[k];
         }
     } else {
         reals = false;
@@ -753,19 +894,20 @@ bool MomentElementBase::check_backward(const state_t& ST) const
     return reals;
 }
 
-void MomentElementBase::resize_cache(const state_t& ST)
+void MomentElementBase::resize_cache(const state_t& ST, cache_t& C) const
 {
-    transfer.resize(ST.real.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
-    misalign.resize(ST.real.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
-    misalign_inv.resize(ST.real.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+    C.transfer.resize(ST.real.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+    C.sparsity.resize(ST.real.size(), Dense);
+    C.misalign.resize(ST.real.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+    C.misalign_inv.resize(ST.real.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
 }
 
-void MomentElementBase::recompute_matrix(state_t& ST)
+void MomentElementBase::recompute_matrix(state_t& ST, cache_t& C) const
 {
     // Default, initialize as no-op
 
-    for(size_t k=0; k<last_real_in.size(); k++) {
-        transfer[k] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+    for(size_t k=0; k<C.last_real_in.size(); k++) {
+        C.transfer[k] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
     }
 }
 
@@ -790,6 +932,7 @@ struct ElementSource : public MomentElementBase
     virtual void show(std::ostream& strm, int level) const override final
     {
         ElementVoid::show(strm, level);
+        istate.update_rms();
         strm<<"Initial: "<<istate.moment0_env<<"\n";
     }
 
@@ -814,9 +957,10 @@ struct ElementMark : public MomentElementBase
     typedef MomentElementBase     base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementMark(const Config& c): base_t(c) {length = 0e0;}
+    ElementMark(const Config& c): base_t(c) {length = 0e0; update_misalign();}
     virtual ~ElementMark() {}
     virtual const char* type_name() const override final {return "marker";}
+    virtual bool passive() const override final { return true; }
 
     virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
 };
@@ -828,9 +972,10 @@ struct ElementBPM : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementBPM(const Config& c): base_t(c) {length = 0e0;}
+    ElementBPM(const Config& c): base_t(c) {length = 0e0; update_misalign();}
     virtual ~ElementBPM() {}
     virtual const char* type_name() const override final {return "bpm";}
+    virtual bool passive() const override final { return true; }
 
     virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
 };
@@ -845,20 +990,21 @@ struct ElementDrift : public MomentElementBase
     ElementDrift(const Config& c) : base_t(c) {}
     virtual ~ElementDrift() {}
     virtual const char* type_name() const override final {return "drift";}
+    virtual bool passive() const override final { return true; }
 
     virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
         // Re-initialize transport matrix.
 
         const double L = length*MtoMM; // Convert from [m] to [mm].
 
-        for(size_t i=0; i<last_real_in.size(); i++) {
-            transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-            transfer[i](state_t::PS_X, state_t::PS_PX) = L;
-            transfer[i](state_t::PS_Y, state_t::PS_PY) = L;
-            transfer[i](state_t::PS_S, state_t::PS_PS) =
+        for(size_t i=0; i<C.last_real_in.size(); i++) {
+            C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+            C.transfer[i](state_t::PS_X, state_t::PS_PX) = L;
+            C.transfer[i](state_t::PS_Y, state_t::PS_PY) = L;
+            C.transfer[i](state_t::PS_S, state_t::PS_PS) =
                 -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*L;
         }
     }
@@ -871,21 +1017,38 @@ struct ElementOrbTrim : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementOrbTrim(const Config& c) : base_t(c) {length = 0e0;}
+    double theta_x, theta_y, tm_xkick, tm_ykick, xyrotate;
+    bool realpara;
+
+    ElementOrbTrim(const Config& c)
+        :base_t(c)
+        ,theta_x(c.get<double>("theta_x", 0e0))
+        ,theta_y(c.get<double>("theta_y", 0e0))
+        ,tm_xkick(c.get<double>("tm_xkick", 0e0))
+        ,tm_ykick(c.get<double>("tm_ykick", 0e0))
+        ,xyrotate(c.get<double>("xyrotate", 0e0)*M_PI/180e0)
+        ,realpara(c.get<double>("realpara", 0e0) == 1e0)
+    {length = 0e0; update_misalign();}
     virtual ~ElementOrbTrim() {}
     virtual const char* type_name() const override final {return "orbtrim";}
+    virtual bool passive() const override final { return true; }
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        theta_x  = O->theta_x;
+        theta_y  = O->theta_y;
+        tm_xkick = O->tm_xkick;
+        tm_ykick = O->tm_ykick;
+        xyrotate = O->xyrotate;
+        realpara = O->realpara;
+    }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
         // Re-initialize transport matrix.
-        double theta_x = conf().get<double>("theta_x", 0e0),
-               theta_y = conf().get<double>("theta_y", 0e0);
-        const double tm_xkick = conf().get<double>("tm_xkick", 0e0),
-                     tm_ykick = conf().get<double>("tm_ykick", 0e0),
-                     xyrotate = conf().get<double>("xyrotate", 0e0)*M_PI/180e0;
-        const bool   realpara = conf().get<double>("realpara", 0e0) == 1e0;
+        double theta_x = this->theta_x,
+               theta_y = this->theta_y;
 
         if (realpara) {
             double ecpi = ST.ref.IonZ*C0/sqrt(sqr(ST.ref.IonW) - sqr(ST.ref.IonEs));
@@ -893,21 +1056,21 @@ struct ElementOrbTrim : public MomentElementBase
             theta_y = tm_ykick*ecpi;
         }
 
-        for(size_t i=0; i<last_real_in.size(); i++) {
-            transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-            transfer[i](state_t::PS_PX, 6) = theta_x*ST.real[i].IonZ/ST.ref.IonZ;
-            transfer[i](state_t::PS_PY, 6) = theta_y*ST.real[i].IonZ/ST.ref.IonZ;
+        for(size_t i=0; i<C.last_real_in.size(); i++) {
+            C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+            C.transfer[i](state_t::PS_PX, 6) = theta_x*ST.real[i].IonZ/ST.ref.IonZ;
+            C.transfer[i](state_t::PS_PY, 6) = theta_y*ST.real[i].IonZ/ST.ref.IonZ;
 
-            get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
+            get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
 
-            noalias(scratch)  = prod(transfer[i], misalign[i]);
-            noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+            MatMult(C.transfer[i], C.misalign[i], C.scratch);
+            MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
 
             if (xyrotate != 0e0) {
                 state_t::matrix_t R;
                 RotMat(0e0, 0e0, 0e0, 0e0, xyrotate, R);
-                noalias(scratch)  = transfer[i];
-                noalias(transfer[i]) = prod(scratch, R);
+                noalias(C.scratch)  = C.transfer[i];
+                MatMult(C.scratch, R, C.transfer[i]);
             }
 
         }
@@ -924,12 +1087,25 @@ struct ElementSBend : public MomentElementBase
     typedef typename base_t::state_t state_t;
 
     unsigned HdipoleFitMode;
-
-    ElementSBend(const Config& c) : base_t(c), HdipoleFitMode(0) {
+    double L, phi, phi1, phi2, K;
+    double bg; //!< only used when HdipoleFitMode==0
+
+    ElementSBend(const Config& c)
+        :base_t(c)
+        ,HdipoleFitMode(0)
+        ,L(c.get<double>("L")*MtoMM)
+        ,phi(c.get<double>("phi")*M_PI/180e0)
+        ,phi1(c.get<double>("phi1")*M_PI/180e0)
+        ,phi2(c.get<double>("phi2")*M_PI/180e0)
+        ,K(c.get<double>("K", 0e0)/sqr(MtoMM))
+        ,bg(0e0)
+    {
 
         HdipoleFitMode = get_flag(c, "HdipoleFitMode", 1);
         if (HdipoleFitMode != 0 && HdipoleFitMode != 1)
             throw std::runtime_error(SB()<< "Undefined HdipoleFitMode: " << HdipoleFitMode);
+        if (!HdipoleFitMode && L != 0.0)
+            bg = c.get<double>("bg");
     }
     virtual ~ElementSBend() {}
     virtual const char* type_name() const override final {return "sbend";}
@@ -938,32 +1114,41 @@ struct ElementSBend : public MomentElementBase
         base_t::assign(other);
         const self_t* O=static_cast<const self_t*>(other);
         HdipoleFitMode = O->HdipoleFitMode;
+        L    = O->L;
+        phi  = O->phi;
+        phi1 = O->phi1;
+        phi2 = O->phi2;
+        K    = O->K;
+        bg   = O->bg;
     }
 
     virtual void advance(StateBase& s) override final
     {
         state_t&  ST = static_cast<state_t&>(s);
+        cache_t&  C = cache<cache_t>(s);
         using namespace boost::numeric::ublas;
 
         // IonEk is Es + E_state; the latter is set by user.
         ST.recalc();
 
-        if(!check_cache(ST)) {
+        if(!check_cache(ST, C)) {
             // need to re-calculate energy dependent terms
-            last_ref_in = ST.ref;
-            last_real_in = ST.real;
-            resize_cache(ST);
+            C.last_ref_in = ST.ref;
+            C.last_real_in = ST.real;
+            C.last_tag_in = ST.particle_tag;
+            resize_cache(ST, C);
 
-            recompute_matrix(ST); // updates transfer and last_Kenergy_out
+            recompute_matrix(ST, C); // updates transfer and last_Kenergy_out
+            C.transfer_inv.clear();
 
             ST.recalc();
-            last_ref_out = ST.ref;
-            last_real_out = ST.real;
+            C.last_ref_out = ST.ref;
+            C.last_real_out = ST.real;
         } else {
-            ST.ref = last_ref_out;
-            assert(last_real_out.size()==ST.real.size()); // should be true if check_cache() -> true
-            std::copy(last_real_out.begin(),
-                      last_real_out.end(),
+            ST.ref = C.last_ref_out;
+            assert(C.last_real_out.size()==ST.real.size()); // should be true if check_cache() -> true
+            std::copy(C.last_real_out.begin(),
+                      C.last_real_out.end(),
                       ST.real.begin());
         }
 
@@ -972,33 +1157,34 @@ struct ElementSBend : public MomentElementBase
             ST.pos += length;
             ST.ref.phis += ST.ref.SampleIonK*length*MtoMM;
 
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 double phis_temp = ST.moment0[i][state_t::PS_S];
 
-                ST.moment0[i]          = prod(transfer[i], ST.moment0[i]);
-
-                noalias(scratch)       = prod(transfer[i], ST.moment1[i]);
-                noalias(ST.moment1[i]) = prod(scratch, trans(transfer[i]));
+                MatVecMult(C.transfer[i], ST.moment0[i]);
+                MatSandwich(C.transfer[i], ST.moment1[i], C.scratch);
 
                 double dphis_temp = ST.moment0[i][state_t::PS_S] - phis_temp;
 
                 ST.real[i].phis  += ST.real[i].SampleIonK*length*MtoMM + dphis_temp;
-                ST.transmat[i] = transfer[i];
+                ST.transmat[i] = C.transfer[i];
             }
         } else {
             // Backward propagation
             ST.pos -= length;
             ST.ref.phis -= ST.ref.SampleIonK*length*MtoMM;
 
-            value_t invmat = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-            for(size_t i=0; i<last_real_in.size(); i++) {
-                double phis_temp = ST.moment0[i][state_t::PS_S];
+            if(C.transfer_inv.size()!=C.transfer.size()) {
+                C.transfer_inv.resize(C.transfer.size(), boost::numeric::ublas::identity_matrix<double>(state_t::maxsize));
+                for(size_t i=0; i<C.transfer.size(); i++)
+                    inverse(C.transfer_inv[i], C.transfer[i]);
+            }
 
-                inverse(invmat, transfer[i]);
-                ST.moment0[i]          = prod(invmat, ST.moment0[i]);
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
+                const value_t& invmat = C.transfer_inv[i];
+                double phis_temp = ST.moment0[i][state_t::PS_S];
 
-                noalias(scratch)       = prod(invmat, ST.moment1[i]);
-                noalias(ST.moment1[i]) = prod(scratch, trans(invmat));
+                MatVecMult(invmat, ST.moment0[i]);
+                MatSandwich(invmat, ST.moment1[i], C.scratch);
 
                 double dphis_temp = ST.moment0[i][state_t::PS_S] - phis_temp;
 
@@ -1007,27 +1193,22 @@ struct ElementSBend : public MomentElementBase
             }
         }
 
-        ST.calc_rms();
+        ST.touch_particles(); // phis depends on moment0
+        ST.invalidate_rms();
     }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
         // Re-initialize transport matrix.
 
-        double L     = conf().get<double>("L")*MtoMM,
-               phi   = conf().get<double>("phi")*M_PI/180e0,
-               phi1  = conf().get<double>("phi1")*M_PI/180e0,
-               phi2  = conf().get<double>("phi2")*M_PI/180e0,
-               K     = conf().get<double>("K", 0e0)/sqr(MtoMM);
-
-        for(size_t i=0; i<last_real_in.size(); i++) {
+        for(size_t i=0; i<C.last_real_in.size(); i++) {
             double qmrel = (ST.real[i].IonZ-ST.ref.IonZ)/ST.ref.IonZ;
 
-            transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+            C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
 
             if (L != 0.0) {
                 if (!HdipoleFitMode) {
-                    double dip_bg    = conf().get<double>("bg"),
+                    double dip_bg    = bg,
                            // Dipole reference energy.
                            dip_Ek    = (sqrt(sqr(dip_bg)+1e0)-1e0)*ST.ref.IonEs,
                            dip_gamma = (dip_Ek+ST.ref.IonEs)/ST.ref.IonEs,
@@ -1036,15 +1217,15 @@ struct ElementSBend : public MomentElementBase
                            dip_IonK  = 2e0*M_PI/(dip_beta*ST.ref.SampleLambda);
 
                     GetSBendMatrix(L, phi, phi1, phi2, K, ST.ref.IonEs, ST.ref.gamma, qmrel,
-                                   dip_beta, dip_gamma, d, dip_IonK, transfer[i]);
+                                   dip_beta, dip_gamma, d, dip_IonK, C.transfer[i]);
                 } else
                     GetSBendMatrix(L, phi, phi1, phi2, K, ST.ref.IonEs, ST.ref.gamma, qmrel,
-                                   ST.ref.beta, ST.ref.gamma, - qmrel, ST.ref.SampleIonK, transfer[i]);
+                                   ST.ref.beta, ST.ref.gamma, - qmrel, ST.ref.SampleIonK, C.transfer[i]);
 
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
 
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
         }
     }
@@ -1057,27 +1238,40 @@ struct ElementQuad : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementQuad(const Config& c) : base_t(c) {}
+    double L;
+    unsigned ncurve;
+    double B2; //!< only used when ncurve==0
+
+    ElementQuad(const Config& c)
+        :base_t(c)
+        ,L(c.get<double>("L")*MtoMM)
+        ,ncurve(get_flag(c, "ncurve", 0))
+        ,B2(ncurve==0 ? c.get<double>("B2") : 0e0)
+    {}
     virtual ~ElementQuad() {}
     virtual const char* type_name() const override final {return "quadrupole";}
+    virtual bool passive() const override final { return true; }
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        L      = O->L;
+        ncurve = O->ncurve;
+        B2     = O->B2;
+    }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
-        const double L = conf().get<double>("L")*MtoMM;
-        const unsigned ncurve = get_flag(conf(), "ncurve", 0);
-
         if (ncurve != 0) {
             std::vector<std::vector<double> > Curves;
             std::vector<double> Scales;
             GetCurveData(conf(), ncurve, Scales, Curves);
 
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 double K;
                 double dL = L/double(Curves[0].size()),
                        Brho = ST.real[i].Brho();
-                transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+                C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
                 for (size_t j=0; j<Curves[0].size(); j++){
                     K = 0.0;
                     for (size_t n=0; n<Curves.size(); n++) K += Scales[n]*Curves[n][j]/Brho/sqr(MtoMM);
@@ -1088,34 +1282,33 @@ struct ElementQuad : public MomentElementBase
                     tmstep(state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*dL;
 
-                    transfer[i] = prod(tmstep, transfer[i]);
+                    MatMultLeft(tmstep, C.transfer[i]);
                 }
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
 
         } else {
-            const double B2= conf().get<double>("B2");
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 // Re-initialize transport matrix.
-                transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+                C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
 
                 double Brho = ST.real[i].Brho(),
                        K = B2/Brho/sqr(MtoMM);
 
                 // Horizontal plane.
-                GetQuadMatrix(L,  K, (unsigned)state_t::PS_X, transfer[i]);
+                GetQuadMatrix(L,  K, (unsigned)state_t::PS_X, C.transfer[i]);
                 // Vertical plane.
-                GetQuadMatrix(L, -K, (unsigned)state_t::PS_Y, transfer[i]);
+                GetQuadMatrix(L, -K, (unsigned)state_t::PS_Y, C.transfer[i]);
                 // Longitudinal plane.
 
-                transfer[i](state_t::PS_S, state_t::PS_PS) =
+                C.transfer[i](state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*L;
 
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
         }
     }
@@ -1128,48 +1321,61 @@ struct ElementSext : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementSext(const Config& c) : base_t(c) {}
+    double B3, L;
+    int step;
+    bool thinlens, dstkick;
+
+    ElementSext(const Config& c)
+        :base_t(c)
+        ,B3(c.get<double>("B3"))
+        ,L(c.get<double>("L")*MtoMM)
+        ,step(c.get<double>("step", 1.0))
+        ,thinlens(c.get<double>("thinlens", 0.0) == 1.0)
+        ,dstkick(c.get<double>("dstkick", 1.0) == 1.0)
+    {}
 
     virtual ~ElementSext() {}
     virtual const char* type_name() const override final {return "sextupole";}
 
-    virtual void assign(const ElementVoid *other) override final {base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        B3       = O->B3;
+        L        = O->L;
+        step     = O->step;
+        thinlens = O->thinlens;
+        dstkick  = O->dstkick;
+    }
 
     virtual void advance(StateBase& s) override final
     {
-        const double B3= conf().get<double>("B3"),
-                     L = conf().get<double>("L")*MtoMM;
-        const int    step = conf().get<double>("step", 1.0);
-        const bool   thinlens = conf().get<double>("thinlens", 0.0) == 1.0,
-                     dstkick = conf().get<double>("dstkick", 1.0) == 1.0;
-
         state_t&  ST = static_cast<state_t&>(s);
+        cache_t&  C = cache<cache_t>(s);
         using namespace boost::numeric::ublas;
 
         ST.recalc();
 
-        last_ref_in = ST.ref;
-        last_real_in = ST.real;
-        resize_cache(ST);
+        C.last_ref_in = ST.ref;
+        C.last_real_in = ST.real;
+        resize_cache(ST, C);
 
         if(ST.retreat) throw std::runtime_error(SB()<<
             "Backward propagation error: Backward propagation does not support sextupole.");
 
         const double dL = L/step;
 
-        for(size_t k=0; k<last_real_in.size(); k++) {
+        for(size_t k=0; k<C.last_real_in.size(); k++) {
 
-            transfer[k] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
-            ST.transmat[k] = transfer[k];
+            C.transfer[k] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+            ST.transmat[k] = C.transfer[k];
 
             double Brho = ST.real[k].Brho(),
                    K = B3/Brho/cube(MtoMM);
 
-            get_misalign(ST, ST.real[k], misalign[k], misalign_inv[k]);
+            get_misalign(ST, ST.real[k], C.misalign[k], C.misalign_inv[k]);
 
-            ST.moment0[k] = prod(misalign[k], ST.moment0[k]);
-            scratch = prod(misalign[k], ST.moment1[k]);
-            ST.moment1[k] = prod(scratch, trans(misalign[k]));
+            MatVecMult(C.misalign[k], ST.moment0[k]);
+            MatSandwich(C.misalign[k], ST.moment1[k], C.scratch);
 
             for(int i=0; i<step; i++){
                 double Dx = ST.moment0[k][state_t::PS_X],
@@ -1179,38 +1385,36 @@ struct ElementSext : public MomentElementBase
                        D2xy = ST.moment1[k](state_t::PS_X, state_t::PS_Y);
 
 
-                GetSextMatrix(dL, K, Dx, Dy, D2x, D2y, D2xy, thinlens, dstkick, transfer[k]);
+                GetSextMatrix(dL, K, Dx, Dy, D2x, D2y, D2xy, thinlens, dstkick, C.transfer[k]);
 
-                transfer[k](state_t::PS_S, state_t::PS_PS) =
+                C.transfer[k](state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[k].SampleLambda*ST.real[k].IonEs/MeVtoeV*cube(ST.real[k].bg))*dL;
 
-                ST.moment0[k] = prod(transfer[k], ST.moment0[k]);
+                MatVecMult(C.transfer[k], ST.moment0[k]);
+                MatSandwich(C.transfer[k], ST.moment1[k], C.scratch);
 
-                scratch = prod(transfer[k], ST.moment1[k]);
-                ST.moment1[k] = prod(scratch, trans(transfer[k]));
-
-                ST.transmat[k] = prod(transfer[k], ST.transmat[k]);
+                MatMultLeft(C.transfer[k], ST.transmat[k]);
             }
-            ST.moment0[k] = prod(misalign_inv[k], ST.moment0[k]);
-            scratch = prod(misalign_inv[k], ST.moment1[k]);
-            ST.moment1[k] = prod(scratch, trans(misalign_inv[k]));
+            MatVecMult(C.misalign_inv[k], ST.moment0[k]);
+            MatSandwich(C.misalign_inv[k], ST.moment1[k], C.scratch);
 
-            scratch = prod(ST.transmat[k], misalign[k]);
-            ST.transmat[k] = prod(misalign_inv[k], scratch);
+            MatMult(ST.transmat[k], C.misalign[k], C.scratch);
+            MatMult(C.misalign_inv[k], C.scratch, ST.transmat[k]);
         }
 
         ST.recalc();
 
-        for(size_t k=0; k<last_real_in.size(); k++)
+        for(size_t k=0; k<C.last_real_in.size(); k++)
             ST.real[k].phis  += ST.real[k].SampleIonK*length*MtoMM;
         ST.ref.phis   += ST.ref.SampleIonK*length*MtoMM;
 
-        last_ref_out = ST.ref;
-        last_real_out = ST.real;
+        ST.touch_particles();
+        C.last_ref_out = ST.ref;
+        C.last_real_out = ST.real;
 
         ST.pos += length;
 
-        ST.calc_rms();
+        ST.invalidate_rms();
     }
 };
 
@@ -1221,27 +1425,40 @@ struct ElementSolenoid : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementSolenoid(const Config& c) : base_t(c) {}
+    double L; //!< [mm]
+    unsigned ncurve;
+    double B; //!< only used when ncurve==0
+
+    ElementSolenoid(const Config& c)
+        :base_t(c)
+        ,L(c.get<double>("L")*MtoMM) // Convert from [m] to [mm].
+        ,ncurve(get_flag(c, "ncurve", 0))
+        ,B(ncurve==0 ? c.get<double>("B") : 0e0)
+    {}
     virtual ~ElementSolenoid() {}
     virtual const char* type_name() const override final {return "solenoid";}
+    virtual bool passive() const override final { return true; }
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        L      = O->L;
+        ncurve = O->ncurve;
+        B      = O->B;
+    }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
-        const double L = conf().get<double>("L")*MtoMM;      // Convert from [m] to [mm].
-        const unsigned ncurve = get_flag(conf(), "ncurve", 0);
-
         if (ncurve != 0) {
             std::vector<std::vector<double> > Curves;
             std::vector<double> Scales;
             GetCurveData(conf(), ncurve, Scales, Curves);
 
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 double K;
                 double dL = L/double(Curves[0].size()),
                        Brho = ST.real[i].Brho();
-                transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+                C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
                 for (size_t j=0; j<Curves[0].size(); j++){
                     K = 0.0;
                     for (size_t n=0; n<Curves.size(); n++) K += Scales[n]*Curves[n][j]/(2e0*Brho)/MtoMM;
@@ -1252,30 +1469,29 @@ struct ElementSolenoid : public MomentElementBase
                     tmstep(state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*dL;
 
-                    transfer[i] = prod(tmstep, transfer[i]);
+                    MatMultLeft(tmstep, C.transfer[i]);
                 }
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
         } else {
-            const double B = conf().get<double>("B");
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 // Re-initialize transport matrix.
-                transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+                C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
 
                 double Brho = ST.real[i].Brho(),
                        K    = B/(2e0*Brho)/MtoMM;
 
-                GetSolMatrix(L, K, transfer[i]);
+                GetSolMatrix(L, K, C.transfer[i]);
 
-                transfer[i](state_t::PS_S, state_t::PS_PS) =
+                C.transfer[i](state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*L;
 
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
 
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
         }
     }
@@ -1288,39 +1504,63 @@ struct ElementEDipole : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementEDipole(const Config& c) : base_t(c) {}
+    bool   ver;
+    double L, phi,
+           fringe_x, fringe_y, // fit to TLM unit.
+           kappa,
+           spher,              // spher: cylindrical - 0, spherical - 1.
+           beta;
+    bool   have_beta;
+    unsigned HdipoleFitMode;
+
+    ElementEDipole(const Config& c)
+        :base_t(c)
+        ,ver(c.get<double>("ver") == 1.0)
+        ,L(c.get<double>("L")*MtoMM)
+        ,phi(c.get<double>("phi")*M_PI/180e0)
+        ,fringe_x(c.get<double>("fringe_x", 0e0)/MtoMM)
+        ,fringe_y(c.get<double>("fringe_y", 0e0)/MtoMM)
+        ,kappa(c.get<double>("asym_fac", 0e0))
+        ,spher(c.get<double>("spher"))
+        ,beta(0e0)
+        ,have_beta(c.tryGet<double>("beta", beta))
+        ,HdipoleFitMode(get_flag(c, "HdipoleFitMode", 1))
+    {
+        if (HdipoleFitMode != 0 && HdipoleFitMode != 1)
+            throw std::runtime_error(SB()<< "Undefined HdipoleFitMode: " << HdipoleFitMode);
+    }
     virtual ~ElementEDipole() {}
     virtual const char* type_name() const override final {return "edipole";}
+    virtual bool passive() const override final { return true; }
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        ver       = O->ver;
+        L         = O->L;
+        phi       = O->phi;
+        fringe_x  = O->fringe_x;
+        fringe_y  = O->fringe_y;
+        kappa     = O->kappa;
+        spher     = O->spher;
+        beta      = O->beta;
+        have_beta = O->have_beta;
+        HdipoleFitMode = O->HdipoleFitMode;
+    }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
         // Re-initialize transport matrix.
 
         //value_mat R;
 
-        bool   ver         = conf().get<double>("ver") == 1.0;
-        double L           = conf().get<double>("L")*MtoMM,
-               phi         = conf().get<double>("phi")*M_PI/180e0,
-               // fit to TLM unit.
-               fringe_x    = conf().get<double>("fringe_x", 0e0)/MtoMM,
-               fringe_y    = conf().get<double>("fringe_y", 0e0)/MtoMM,
-               kappa       = conf().get<double>("asym_fac", 0e0),
-               // spher: cylindrical - 0, spherical - 1.
-               spher       = conf().get<double>("spher"),
-               // magnetic - 0, electrostatic - 1.
-               h           = 1e0,
-               dip_beta    = conf().get<double>("beta", ST.ref.beta);
-
-        unsigned HdipoleFitMode = get_flag(conf(), "HdipoleFitMode", 1);
-
-        if (HdipoleFitMode != 0 && HdipoleFitMode != 1)
-            throw std::runtime_error(SB()<< "Undefined HdipoleFitMode: " << HdipoleFitMode);
+        // magnetic - 0, electrostatic - 1.
+        const double h = 1e0;
+        double dip_beta = have_beta ? beta : ST.ref.beta;
 
         if (HdipoleFitMode) dip_beta = ST.ref.beta;
 
-        for(size_t i=0; i<last_real_in.size(); i++) {
+        for(size_t i=0; i<C.last_real_in.size(); i++) {
             double eta0        = (1e0/sqrt(1e0 - sqr(dip_beta)) - 1e0)/2e0,
                    Erho        = sqr(ST.real[i].beta)/ST.real[i].IonZ,
                    Erho0       = sqr(dip_beta)/ST.ref.IonZ,
@@ -1332,11 +1572,11 @@ struct ElementEDipole : public MomentElementBase
                    delta_KZ    = ST.ref.IonZ/ST.real[i].IonZ - 1e0,
                    SampleIonK  = 2e0*M_PI/(ST.real[i].beta*ST.real[i].SampleLambda);
 
-            transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+            C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
 
             if (L != 0e0) {
                 GetEBendMatrix(eL, phi, fringe_x, fringe_y, kappa, Kx, Ky, ST.ref.IonEs, ST.real[i].gamma,
-                               eta0, h, delta_K, delta_KZ, SampleIonK, transfer[i]);
+                               eta0, h, delta_K, delta_KZ, SampleIonK, C.transfer[i]);
 
                 if (ver) {
                     // Rotate transport matrix by 90 degrees.
@@ -1351,15 +1591,14 @@ struct ElementEDipole : public MomentElementBase
                     R(state_t::PS_Y,  state_t::PS_X)   =  1e0;
                     R(state_t::PS_PY,  state_t::PS_PX) =  1e0;
 
-                    noalias(scratch)     = prod(R, transfer[i]);
-                    noalias(transfer[i]) = prod(scratch, trans(R));
+                    MatSandwich(R, C.transfer[i], C.scratch);
                     //TODO: no-op code?  results are unconditionally overwritten
                 }
 
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
 
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
         }
     }
@@ -1372,27 +1611,42 @@ struct ElementEQuad : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementEQuad(const Config& c) : base_t(c) {}
+    double L;
+    unsigned ncurve;
+    double V0, R; //!< only used when ncurve==0
+
+    ElementEQuad(const Config& c)
+        :base_t(c)
+        ,L(c.get<double>("L")*MtoMM)
+        ,ncurve(get_flag(c, "ncurve", 0))
+        ,V0(ncurve==0 ? c.get<double>("V") : 0e0)
+        ,R(ncurve==0 ? c.get<double>("radius") : 0e0)
+    {}
     virtual ~ElementEQuad() {}
     virtual const char* type_name() const override final {return "equad";}
+    virtual bool passive() const override final { return true; }
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        L      = O->L;
+        ncurve = O->ncurve;
+        V0     = O->V0;
+        R      = O->R;
+    }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
-        const double   L      = conf().get<double>("L")*MtoMM;
-        const unsigned ncurve = get_flag(conf(), "ncurve", 0);
-
         if (ncurve != 0) {
             std::vector<std::vector<double> > Curves;
             std::vector<double> Scales;
             GetCurveData(conf(), ncurve, Scales, Curves);
 
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 double K;
                 double dL = L/double(Curves[0].size()),
                        Brho = ST.real[i].Brho();
-                transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+                C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
                 for (size_t j=0; j<Curves[0].size(); j++){
                     K = 0.0;
                     for (size_t n=0; n<Curves.size(); n++) K += 2e0*Scales[n]*Curves[n][j]/(C0*ST.real[i].beta)/Brho/sqr(MtoMM);
@@ -1403,39 +1657,36 @@ struct ElementEQuad : public MomentElementBase
                     tmstep(state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*dL;
 
-                    transfer[i] = prod(tmstep, transfer[i]);
+                    MatMultLeft(tmstep, C.transfer[i]);
                 }
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
 
         } else {
-            const double V0 = conf().get<double>("V"),
-                         R  = conf().get<double>("radius");
-
-            for(size_t i=0; i<last_real_in.size(); i++) {
+            for(size_t i=0; i<C.last_real_in.size(); i++) {
                 // Re-initialize transport matrix.
                 // V0 [V] electrode voltage and R [m] electrode half-distance.
-                transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
+                C.transfer[i] = boost::numeric::ublas::identity_matrix<double>(state_t::maxsize);
 
                 double Brho = ST.real[i].Brho(),
                        K    = 2e0*V0/(C0*ST.real[i].beta*sqr(R))/Brho/sqr(MtoMM);
 
                 // Horizontal plane.
-                GetQuadMatrix(L,  K, (unsigned)state_t::PS_X, transfer[i]);
+                GetQuadMatrix(L,  K, (unsigned)state_t::PS_X, C.transfer[i]);
                 // Vertical plane.
-                GetQuadMatrix(L, -K, (unsigned)state_t::PS_Y, transfer[i]);
+                GetQuadMatrix(L, -K, (unsigned)state_t::PS_Y, C.transfer[i]);
                 // Longitudinal plane.
                 //        transfer(state_t::PS_S, state_t::PS_S) = L;
 
-                transfer[i](state_t::PS_S, state_t::PS_PS) =
+                C.transfer[i](state_t::PS_S, state_t::PS_PS) =
                         -2e0*M_PI/(ST.real[i].SampleLambda*ST.real[i].IonEs/MeVtoeV*cube(ST.real[i].bg))*L;
 
-                get_misalign(ST, ST.real[i], misalign[i], misalign_inv[i]);
+                get_misalign(ST, ST.real[i], C.misalign[i], C.misalign_inv[i]);
 
-                noalias(scratch)     = prod(transfer[i], misalign[i]);
-                noalias(transfer[i]) = prod(misalign_inv[i], scratch);
+                MatMult(C.transfer[i], C.misalign[i], C.scratch);
+                MatMult(C.misalign_inv[i], C.scratch, C.transfer[i]);
             }
         }
     }
@@ -1448,16 +1699,28 @@ struct ElementTMatrix : public MomentElementBase
     typedef MomentElementBase       base_t;
     typedef typename base_t::state_t state_t;
 
-    ElementTMatrix(const Config& c) : base_t(c) {}
+    value_t matrix;
+
+    ElementTMatrix(const Config& c)
+        :base_t(c)
+        ,matrix(state_t::maxsize, state_t::maxsize)
+    {
+        load_storage(matrix.data(), c, "matrix");
+    }
     virtual ~ElementTMatrix() {}
     virtual const char* type_name() const override final {return "tmatrix";}
+    virtual bool passive() const override final { return true; }
 
-    virtual void assign(const ElementVoid *other) override final { base_t::assign(other); }
+    virtual void assign(const ElementVoid *other) override final {
+        base_t::assign(other);
+        const self_t* O=static_cast<const self_t*>(other);
+        matrix = O->matrix;
+    }
 
-    virtual void recompute_matrix(state_t& ST) override final
+    virtual void recompute_matrix(state_t& ST, cache_t& C) const override final
     {
-        for(size_t i=0; i<last_real_in.size(); i++) {
-            load_storage(transfer[i].data(), conf(), "matrix");
+        for(size_t i=0; i<C.last_real_in.size(); i++) {
+            C.transfer[i] = matrix;
         }
     }
 };
@@ -1,10 +1,10 @@
 
 #include <boost/lexical_cast.hpp>
-#include <boost/filesystem.hpp>
 #include <boost/numeric/ublas/lu.hpp>
 
 #include "flame/constants.h"
 #include "flame/moment.h"
+#include "flame/moment_sup.h"
 
 #define sqr(x)  ((x)*(x))
 #define cube(x) ((x)*(x)*(x))
@@ -15,8 +15,6 @@
     #define defpath "."
 #endif
 
-std::map<std::string,std::shared_ptr<Config> > CurveMap;
-
 // http://www.crystalclearsoftware.com/cgi-bin/boost_wiki/wiki.pl?LU_Matrix_Inversion
 // by LU-decomposition.
 void inverse(MomentElementBase::value_t& out, const MomentElementBase::value_t& in)
@@ -35,6 +33,40 @@ void inverse(MomentElementBase::value_t& out, const MomentElementBase::value_t&
     lu_substitute(scratch, pm, out);
 }
 
+namespace {
+template<MomentElementBase::sparsity_t S>
+bool has_sparsity(const MomentElementBase::value_t& M)
+{
+    typedef detail::sparsity_range<S> R;
+    enum {N=MomentState::maxsize};
+    for(unsigned i=0; i<N; i++) {
+        for(unsigned j=0; j<N; j++) {
+            if(j>=R::lo(i) && j<R::hi(i))
+                continue;
+            else if(M(i,j)!=0e0)
+                return false;
+        }
+    }
+    return M(N-1,N-1)==1e0;
+}
+}
+
+MomentElementBase::sparsity_t MatSparsity(const MomentElementBase::value_t& M)
+{
+    enum {N=MomentState::maxsize};
+    if(M.size1()!=N || M.size2()!=N)
+        return MomentElementBase::Dense;
+    else if(has_sparsity<MomentElementBase::Block2>(M)) {
+        bool ident = true;
+        for(unsigned i=0; ident && i<N-1; i+=2)
+            ident = M(i,i)==1e0 && M(i,i+1)==0e0 && M(i+1,i)==0e0 && M(i+1,i+1)==1e0;
+        return ident ? MomentElementBase::Identity : MomentElementBase::Block2;
+    } else if(has_sparsity<MomentElementBase::Block4>(M))
+        return MomentElementBase::Block4;
+    else
+        return MomentElementBase::Dense;
+}
+
 void RotMat(const double dx, const double dy,
             const double theta_x, const double theta_y, const double theta_z,
             typename MomentElementBase::value_t &R)
@@ -69,7 +101,8 @@ void RotMat(const double dx, const double dy,
 
     T(0, 6) = -dx, T(2, 6) = -dy;
 
-    R = prod(R, T);
+    MatMultLeft(R, T);
+    R = T;
 }
 
 
@@ -141,8 +174,8 @@ void GetSextMatrix(const double L, const double K3, double Dx, double Dy,
         P(state_t::PS_PY, state_t::PS_X) = K3*L*Dy;
         P(state_t::PS_PY, state_t::PS_Y) = K3*L*Dx;
 
-        scratch = prod(P,T);
-        M = prod(T,scratch);
+        MatMult(P, T, scratch);
+        MatMult(T, scratch, M);
 
     } else {
 
@@ -220,7 +253,7 @@ void GetSBendMatrix(const double L, const double phi, const double phi1, const d
 {
     typedef typename MomentElementBase::state_t state_t;
 
-    MomentState::matrix_t edge1, edge2, R;
+    MomentState::matrix_t edge1, edge2, scratch;
 
     double  rho = L/phi,
             Kx  = K + 1e0/sqr(rho),
@@ -264,8 +297,8 @@ void GetSBendMatrix(const double L, const double phi, const double phi1, const d
     GetEdgeMatrix(rho, phi1, edge1);
     GetEdgeMatrix(rho, phi2, edge2);
 
-    M = prod(M, edge1);
-    M = prod(edge2, M);
+    MatMult(M, edge1, scratch);
+    MatMult(edge2, scratch, M);
 
     // Longitudinal plane.
     // For total path length.
@@ -326,7 +359,7 @@ void GetEBendMatrix(const double L, const double phi, const double fringe_x, con
 {
     typedef typename MomentElementBase::state_t state_t;
 
-    MomentState::matrix_t edge;
+    MomentState::matrix_t edge, scratch;
 
     double  rho = L/phi,
             scl = (real_gamma - 1e0)*IonEs/MeVtoeV,
@@ -374,8 +407,8 @@ void GetEBendMatrix(const double L, const double phi, const double fringe_x, con
     // Edge focusing.
     GetEEdgeMatrix(fringe_x, fringe_y ,kappa, edge);
 
-    M = prod(M, edge);
-    M = prod(edge, M);
+    MatMult(M, edge, scratch);
+    MatMult(edge, scratch, M);
 
     // Longitudinal plane.
     // For total path length.
@@ -385,7 +418,7 @@ void GetEBendMatrix(const double L, const double phi, const double fringe_x, con
 void GetCurveData(const Config &c, const unsigned ncurve, std::vector<double> &Scales,
                   std::vector<std::vector<double> > &Curves)
 {
-    std::shared_ptr<Config> conf;
+    std::shared_ptr<const Config> conf;
 
     std::string filename;
     std::vector<double> range;
@@ -395,25 +428,14 @@ void GetCurveData(const Config &c, const unsigned ncurve, std::vector<double> &S
     if (checker){
         std::string CurveFile =  c.get<std::string>("Eng_Data_Dir", defpath);
         CurveFile += "/" + filename;
-        std::string key(SB()<<CurveFile<<"|"<<boost::filesystem::last_write_time(CurveFile));
-        if ( CurveMap.find(key) == CurveMap.end() ) {
-            // not found in CurveMap
+        conf = data_file_cache::get()->fetch<Config>("curve", data_file_cache::files_t(1, CurveFile), [&CurveFile]() {
             try {
-                try {
-                    GLPSParser P;
-                    conf.reset(P.parse_file(CurveFile.c_str(), false));
-                }catch(std::exception& e){
-                    throw std::runtime_error(SB()<<"Parse error: "<<e.what()<<"\n");
-                }
-
+                GLPSParser P;
+                return std::shared_ptr<Config>(P.parse_file(CurveFile.c_str(), false));
             }catch(std::exception& e){
-                throw std::runtime_error(SB()<<"Error: "<<e.what()<<"\n");
+                throw std::runtime_error(SB()<<"Parse error: "<<e.what()<<"\n");
             }
-            CurveMap.insert(std::make_pair(key, conf));
-        } else {
-            // found in CurveMap
-            conf=CurveMap[key];
-        }
+        });
     }
 
     size_t prev_size = 0;
@@ -2,7 +2,7 @@
 #include <fstream>
 
 #include <boost/lexical_cast.hpp>
-#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "flame/constants.h"
 #include "flame/moment.h"
@@ -19,8 +19,6 @@
     #define defpath "."
 #endif
 
-std::map<std::string,std::shared_ptr<Config> > ElementRFCavity::CavConfMap;
-
 // RF Cavity beam dynamics functions.
 
 static double ipow(double base, int exp)
@@ -129,102 +127,237 @@ int get_column(const std::string &str)
 }
 
 
-void calTransfac(const numeric_table& fldmap, int column_no, const int gaplabel, const double IonK, const bool half,
-                 double &Ecenter, double &T, double &Tp, double &S, double &Sp, double &V0)
+// One column of a field map, pre-processed for the computation of transit time factors.
+// integrate() evaluates all of the integrals in one pass over the field map.
+// Optionally, results are tabulated on a uniform grid of IonK as they are needed.
+// Between grid nodes, each factor is interpolated by a cubic Hermite spline using
+// its analytic derivative w.r.t. IonK (eg. dT/dIonK == Tp).
+struct ElementRFCavity::ttf_table
 {
-    // Compute electric center, amplitude, and transit time factors [T, Tp, S, Sp] for RF cavity mode.
-    int                 n, k;
-    double              len, dz, eml, em_mom;
-    std::vector<double> z, EM;
+    // Upper limit on the # of grid nodes.  integrate() is used beyond this.
+    enum {maxnodes = 100000};
 
-    column_no--; // F*** fortran
-    assert(column_no>0);
+    ttf_table(const numeric_table& fldmap, int column_no, const bool half)
+    {
+        int n, k;
+
+        column_no--; // F*** fortran
+        assert(column_no>0);
 
-    n = fldmap.table.size1();
+        n = fldmap.table.size1();
 
-    if(n<=0 || (size_t)column_no>=fldmap.table.size2())
-        throw std::runtime_error("field map size invalid");
+        if(n<=0 || (size_t)column_no>=fldmap.table.size2())
+            throw std::runtime_error("field map size invalid");
 
-    z.resize(n);
-    EM.resize(n);
+        std::vector<double> z(n), EM(n);
 
-    std::copy(fldmap.table.find1(2, 0, 0),
-              fldmap.table.find1(2, n, 0),
-              z.begin());
-    std::copy(fldmap.table.find1(2, 0, column_no),
-              fldmap.table.find1(2, n, column_no),
-              EM.begin());
+        std::copy(fldmap.table.find1(2, 0, 0),
+                  fldmap.table.find1(2, n, 0),
+                  z.begin());
+        std::copy(fldmap.table.find1(2, 0, column_no),
+                  fldmap.table.find1(2, n, column_no),
+                  EM.begin());
 
-    // Used at end of function.
-    len = z[n-1];
+        // Used at end of integrate().
+        len = z[n-1];
 
-    if (half) n = (int)round((n-1)/2e0);
+        if (half) n = (int)round((n-1)/2e0);
 
-    dz  = (z[n-1]-z[0])/(n-1);
+        dz  = (z[n-1]-z[0])/(n-1);
 
-//    prt_data(z, EM);
+        // Start at zero.
+        for (k = n-1; k >= 0; k--)
+            z[k] -= z[0];
 
-    // Start at zero.
-    for (k = n-1; k >= 0; k--)
-        z[k] -= z[0];
+        double em_mom = 0e0;
+        eml = 0e0;
+        for (k = 0; k < n-1; k++) {
+            eml    += (fabs(EM[k])+fabs(EM[k+1]))/2e0*dz;
+            em_mom += (z[k]+z[k+1])/2e0*(fabs(EM[k])+fabs(EM[k+1]))/2e0*dz;
+        }
+        Ecenter = em_mom/eml;
+
+        for (k = 0; k < n; k++)
+            z[k] -= Ecenter;
+
+        double zmax = 0e0;
+        zm.resize(n-1);
+        em.resize(n-1);
+        zmem.resize(n-1);
+        dzk.resize(n-1);
+        for (k = 0; k < n-1; k++) {
+            zm[k]   = (z[k]+z[k+1])/2e0;
+            em[k]   = (EM[k]+EM[k+1])/2e0;
+            zmem[k] = zm[k]*em[k];
+            dzk[k]  = z[k+1]-z[k];
+            zmax = std::max(zmax, fabs(zm[k]));
+        }
 
-    eml = 0e0, em_mom = 0e0;
-    for (k = 0; k < n-1; k++) {
-        eml    += (fabs(EM[k])+fabs(EM[k+1]))/2e0*dz;
-        em_mom += (z[k]+z[k+1])/2e0*(fabs(EM[k])+fabs(EM[k+1]))/2e0*dz;
+        // interpolation error is ~ (step*zmax)^4/384 relative
+        step = 1e-2/zmax;
     }
-    Ecenter = em_mom/eml;
 
-    for (k = 0; k < n; k++)
-        z[k] -= Ecenter;
+    // Compute electric center, amplitude, and transit time factors [T, Tp, S, Sp] by integration.
+    void integrate(const int gaplabel, const double IonK,
+                   double &Ec, double &T, double &Tp, double &S, double &Sp, double &V) const
+    {
+        const size_t n = zm.size();
+        const double *pzm = zm.data(), *pem = em.data(), *pzmem = zmem.data(), *pdzk = dzk.data();
+
+        // Each sum is accumulated in the same order as separate loops would
+        T = Tp = S = Sp = 0e0;
+        for (size_t k = 0; k < n; k++) {
+            const double c = cos(IonK*pzm[k]),
+                         s = sin(IonK*pzm[k]);
+            T  += pem[k]*c*dz;
+            Tp -= pzmem[k]*s*dz;
+            S  += pem[k]*s*pdzk[k];
+            Sp += pzmem[k]*c*dz;
+        }
+        T  /= eml;
+        Tp /= eml;
+        S  /= eml;
+        Sp /= eml;
 
-    T = 0;
-    for (k = 0; k < n-1; k++)
-        T += (EM[k]+EM[k+1])/2e0*cos(IonK*(z[k]+z[k+1])/2e0)*dz;
-    T /= eml;
+        finish(gaplabel, Ec, T, Tp, V);
+    }
 
-    Tp = 0;
-    for (k = 0; k < n-1; k++)
-        Tp -= ((z[k]+z[k+1])/2e0)*(EM[k]+EM[k+1])/2e0*sin(IonK*(z[k]+z[k+1])/2e0)*dz;
-    Tp /= eml;
+    // Interpolate tabulated values.
+    // @returns false if IonK is outside of the table
+    bool eval(const int gaplabel, const double IonK,
+              double &Ec, double &T, double &Tp, double &S, double &Sp, double &V) const
+    {
+        const double x = IonK/step;
+        if(!(x>=0e0 && x<maxnodes-1)) // also false for NaN
+            return false;
+        const size_t i = (size_t)x;
+        const double t = x-i, h = step;
+
+        // Hermite basis functions
+        const double h00 = (1e0+2e0*t)*sqr(1e0-t),
+                     h10 = t*sqr(1e0-t),
+                     h01 = sqr(t)*(3e0-2e0*t),
+                     h11 = sqr(t)*(t-1e0);
 
-    S = 0e0;
-    for (k = 0; k < n-1; k++)
-        S += (EM[k]+EM[k+1])/2e0*sin(IonK*(z[k]+z[k+1])/2e0)*(z[k+1]-z[k]);
-    S /= eml;
+        {
+            boost::mutex::scoped_lock G(lock);
+            if(i+1>=nodes.size())
+                nodes.resize(i+2);
+            const node_t &A = node(i), &B = node(i+1);
+
+            T  = h00*A.T  + h10*h*A.Tp  + h01*B.T  + h11*h*B.Tp;
+            Tp = h00*A.Tp + h10*h*A.dTp + h01*B.Tp + h11*h*B.dTp;
+            S  = h00*A.S  + h10*h*A.dS  + h01*B.S  + h11*h*B.dS;
+            Sp = h00*A.Sp + h10*h*A.dSp + h01*B.Sp + h11*h*B.dSp;
+        }
 
-    Sp = 0e0;
-    for (k = 0; k < n-1; k++) {
-        Sp += (z[k]+z[k+1])/2e0*(EM[k]+EM[k+1])/2e0*cos(IonK*(z[k]+z[k+1])/2e0)*dz;
+        finish(gaplabel, Ec, T, Tp, V);
+        return true;
     }
-    Sp /= eml;
 
-    V0 = eml/MeVtoeV/MtoMM;
+private:
+    struct node_t {
+        node_t() :valid(false) {}
+        bool valid;
+        double T, Tp, S, Sp;
+        double dTp, dS, dSp; // derivatives w.r.t. IonK
+    };
 
-    if (gaplabel == 2) {
-        // Second gap.
-        Ecenter = len - Ecenter;
-        T  = -T;
-        Tp = -Tp;
+    void finish(const int gaplabel, double &Ec, double &T, double &Tp, double &V) const
+    {
+        Ec = Ecenter;
+        V  = eml/MeVtoeV/MtoMM;
+
+        if (gaplabel == 2) {
+            // Second gap.
+            Ec = len - Ec;
+            T  = -T;
+            Tp = -Tp;
+        }
     }
+
+    // call with lock held, and nodes.size()>i
+    const node_t& node(size_t i) const
+    {
+        node_t& N = nodes[i];
+        if(!N.valid) {
+            const double IonK = i*step;
+            N.T = N.Tp = N.S = N.Sp = N.dTp = N.dS = N.dSp = 0e0;
+            for (size_t k = 0; k < zm.size(); k++) {
+                const double c = cos(IonK*zm[k]), s = sin(IonK*zm[k]);
+                N.T   += em[k]*c*dz;
+                N.Tp  -= zmem[k]*s*dz;
+                N.S   += em[k]*s*dzk[k];
+                N.Sp  += zmem[k]*c*dz;
+                N.dTp -= zm[k]*zmem[k]*c*dz;
+                N.dS  += zmem[k]*c*dzk[k];
+                N.dSp -= zm[k]*zmem[k]*s*dz;
+            }
+            N.T /= eml; N.Tp /= eml; N.S /= eml; N.Sp /= eml;
+            N.dTp /= eml; N.dS /= eml; N.dSp /= eml;
+            N.valid = true;
+        }
+        return N;
+    }
+
+    std::vector<double> zm,   // mid-points of field map intervals, w.r.t. electric center
+                        em,   // mean field of each interval
+                        zmem, // zm*em
+                        dzk;  // length of each interval
+    double len, dz, eml, Ecenter, step;
+
+    mutable boost::mutex lock;
+    mutable std::vector<node_t> nodes; // guarded by lock
+};
+
+
+void calTransfac(const numeric_table& fldmap, int column_no, const int gaplabel, const double IonK, const bool half,
+                 double &Ecenter, double &T, double &Tp, double &S, double &Sp, double &V0)
+{
+    // Compute electric center, amplitude, and transit time factors [T, Tp, S, Sp] for RF cavity mode.
+    ElementRFCavity::ttf_table(fldmap, column_no, half).integrate(gaplabel, IonK, Ecenter, T, Tp, S, Sp, V0);
 }
 
+namespace {
+// calTransfac(), using tabulated values if possible, and pre-processed field map if available
+void tabTransfac(const ElementRFCavity::ttf_table *tab, const bool interpolate,
+                 const numeric_table& fldmap, int column_no, const int gaplabel, const double IonK, const bool half,
+                 double &Ecenter, double &T, double &Tp, double &S, double &Sp, double &V0)
+{
+    if(!tab)
+        calTransfac(fldmap, column_no, gaplabel, IonK, half, Ecenter, T, Tp, S, Sp, V0);
+    else if(!interpolate || !tab->eval(gaplabel, IonK, Ecenter, T, Tp, S, Sp, V0))
+        tab->integrate(gaplabel, IonK, Ecenter, T, Tp, S, Sp, V0);
+}
+}
+
+
+ElementRFCavity::fit_arg::fit_arg(double x)
+    :x(x)
+{
+    p[0] = 1e0;
+    for (int k = 1; k < 10; k++)
+        p[k] = pow(x, k);
+}
 
-double PwrSeries(const double beta,
+static
+double PwrSeries(const ElementRFCavity::fit_arg& beta,
                  const double a0, const double a1, const double a2, const double a3,
                  const double a4, const double a5, const double a6, const double a7,
                  const double a8, const double a9)
 {
-    int    k;
-    double f;
-
-    const int    n   = 10;
-    const double a[] = {a0, a1, a2, a3, a4, a5, a6, a7, a8, a9};
-
-    f = a[0];
-    for (k = 1; k < n; k++)
-        f += a[k]*pow(beta, k);
-
+    // same order of summation as a0 + a1*pow(beta, 1) + ...
+    const double *p = beta.p;
+    double f = a0;
+    f += a1*p[1];
+    f += a2*p[2];
+    f += a3*p[3];
+    f += a4*p[4];
+    f += a5*p[5];
+    f += a6*p[6];
+    f += a7*p[7];
+    f += a8*p[8];
+    f += a9*p[9];
     return f;
 }
 
@@ -237,16 +370,19 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
 
     // For debugging of TTF function.
     if (forcettfcalc) {
-        calTransfac(CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
+        tabTransfac(model->CavTTF.get(), false, *model->CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
         V0 *= EfieldScl;
         return;
     }
 
+    // shared by all fits below
+    const fit_arg B(beta);
+
     switch (cavilabel) {
     case 41:
         if (beta < 0.025 || beta > 0.08) {
             FLAME_LOG(DEBUG) << "*** TransFacts: CaviIonK out of Range " << cavilabel << "\n";
-            calTransfac(CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
+            tabTransfac(model->CavTTF.get(), true, *model->CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
             V0 *= EfieldScl;
             return;
         }
@@ -256,26 +392,26 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
             Ecen = 120.0; // [mm].
             T    = 0.0;
             Tp   = 0.0;
-            S    = PwrSeries(beta, -4.109, 399.9, -1.269e4, 1.991e5, -1.569e6, 4.957e6, 0.0, 0.0, 0.0, 0.0);
-            Sp   = PwrSeries(beta, 61.98, -1.073e4, 4.841e5, 9.284e6, 8.379e7, -2.926e8, 0.0, 0.0, 0.0, 0.0);
+            S    = PwrSeries(B, -4.109, 399.9, -1.269e4, 1.991e5, -1.569e6, 4.957e6, 0.0, 0.0, 0.0, 0.0);
+            Sp   = PwrSeries(B, 61.98, -1.073e4, 4.841e5, 9.284e6, 8.379e7, -2.926e8, 0.0, 0.0, 0.0, 0.0);
             V0   = 0.98477*EfieldScl;
             break;
         case 1:
             // Two gap calculation, first gap.
             Ecen = 0.0006384*pow(beta, -1.884) + 86.69;
-            T    = PwrSeries(beta, 0.9232, -123.2, 3570, -5.476e4, 4.316e5, -1.377e6, 0.0, 0.0, 0.0, 0.0);
-            Tp   = PwrSeries(beta, 1.699, 924.7, -4.062e4, 7.528e5, -6.631e6, 2.277e7, 0.0, 0.0, 0.0, 0.0);
+            T    = PwrSeries(B, 0.9232, -123.2, 3570, -5.476e4, 4.316e5, -1.377e6, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, 1.699, 924.7, -4.062e4, 7.528e5, -6.631e6, 2.277e7, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
-            Sp   = PwrSeries(beta, -1.571, 25.59, 806.6, -2.98e4, 3.385e5, -1.335e6, 0.0, 0.0, 0.0, 0.0);
+            Sp   = PwrSeries(B, -1.571, 25.59, 806.6, -2.98e4, 3.385e5, -1.335e6, 0.0, 0.0, 0.0, 0.0);
             V0   = 0.492385*EfieldScl;
             break;
         case 2:
             // Two gap calculation, second gap.
             Ecen = -0.0006384*pow(beta, -1.884) + 33.31;
-            T    = PwrSeries(beta, -0.9232, 123.2, -3570, 5.476e4, -4.316e5, 1.377e6, 0.0, 0.0, 0.0, 0.0);
-            Tp   = PwrSeries(beta, -1.699, -924.7, 4.062e4, -7.528e5, 6.631e6, -2.277e7, 0.0, 0.0, 0.0, 0.0);
+            T    = PwrSeries(B, -0.9232, 123.2, -3570, 5.476e4, -4.316e5, 1.377e6, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, -1.699, -924.7, 4.062e4, -7.528e5, 6.631e6, -2.277e7, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
-            Sp    = PwrSeries(beta, -1.571, 25.59, 806.6, -2.98e4, 3.385e5, -1.335e6, 0.0, 0.0, 0.0, 0.0);
+            Sp    = PwrSeries(B, -1.571, 25.59, 806.6, -2.98e4, 3.385e5, -1.335e6, 0.0, 0.0, 0.0, 0.0);
             V0   = 0.492385*EfieldScl;
             break;
         default:
@@ -286,7 +422,7 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
     case 85:
         if (beta < 0.05 || beta > 0.25) {
             FLAME_LOG(DEBUG) << "*** TransFacts: CaviIonK out of Range " << cavilabel << "\n";
-            calTransfac(CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
+            tabTransfac(model->CavTTF.get(), true, *model->CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
             V0 *= EfieldScl;
             return;
         }
@@ -295,14 +431,14 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
             Ecen = 150.0; // [mm].
             T    = 0.0;
             Tp   = 0.0;
-            S    = PwrSeries(beta, -6.811, 343.9, -6385, 6.477e4, -3.914e5, 1.407e6, -2.781e6, 2.326e6, 0.0, 0.0);
-            Sp   = PwrSeries(beta, 162.7, -1.631e4, 4.315e5, -5.344e6, 3.691e7, -1.462e8, 3.109e8, -2.755e8, 0.0, 0.0);
+            S    = PwrSeries(B, -6.811, 343.9, -6385, 6.477e4, -3.914e5, 1.407e6, -2.781e6, 2.326e6, 0.0, 0.0);
+            Sp   = PwrSeries(B, 162.7, -1.631e4, 4.315e5, -5.344e6, 3.691e7, -1.462e8, 3.109e8, -2.755e8, 0.0, 0.0);
             V0   = 1.967715*EfieldScl;
             break;
         case 1:
             Ecen = 0.0002838*pow(beta, -2.13) + 76.5;
             T    = 0.0009467*pow(beta, -1.855) - 1.002;
-            Tp   = PwrSeries(beta, 24.44, -334, 2468, -1.017e4, 2.195e4, -1.928e4, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, 24.44, -334, 2468, -1.017e4, 2.195e4, -1.928e4, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
             Sp   = -0.0009751*pow(beta, -1.898) + 0.001568;
             V0   = 0.9838574*EfieldScl;
@@ -310,7 +446,7 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
         case 2:
             Ecen = -0.0002838*pow(beta, -2.13) + 73.5;
             T    = -0.0009467*pow(beta, -1.855) + 1.002;
-            Tp   = PwrSeries(beta, -24.44, 334, -2468, 1.017e4, -2.195e4, 1.928e4, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, -24.44, 334, -2468, 1.017e4, -2.195e4, 1.928e4, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
             Sp   = -0.0009751*pow(beta, -1.898) + 0.001568;
             V0   = 0.9838574*EfieldScl;
@@ -323,7 +459,7 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
     case 29:
         if (beta < 0.15 || beta > 0.4) {
             FLAME_LOG(DEBUG) << "*** TransFacts: CaviIonK out of Range " << cavilabel << "\n";
-            calTransfac(CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
+            tabTransfac(model->CavTTF.get(), true, *model->CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
             V0 *= EfieldScl;
             return;
         }
@@ -332,24 +468,24 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
             Ecen = 150.0; // [mm].
             T    = 0.0;
             Tp   = 0.0;
-            S    = PwrSeries(beta, -4.285, 58.08, -248, 486, -405.6, 76.54, 0.0, 0.0, 0.0, 0.0);
-            Sp   = PwrSeries(beta, 888, -2.043e4, 1.854e5, -9.127e5, 2.695e6, -4.791e6, 4.751e6, -2.025e6, 0.0, 0.0);
+            S    = PwrSeries(B, -4.285, 58.08, -248, 486, -405.6, 76.54, 0.0, 0.0, 0.0, 0.0);
+            Sp   = PwrSeries(B, 888, -2.043e4, 1.854e5, -9.127e5, 2.695e6, -4.791e6, 4.751e6, -2.025e6, 0.0, 0.0);
             V0   = 2.485036*EfieldScl;
             break;
         case 1:
             Ecen = 0.01163*pow(beta, -2.001) + 91.77;
             T    = 0.02166*pow(beta, -1.618) - 1.022;
-            Tp   = PwrSeries(beta, -11.25, 534.7, -3917, 1.313e4, -2.147e4, 1.389e4, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, -11.25, 534.7, -3917, 1.313e4, -2.147e4, 1.389e4, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
-            Sp   = PwrSeries(beta, -0.8283, -4.409, 78.77, -343.9, 645.1, -454.4, 0.0, 0.0, 0.0, 0.0);
+            Sp   = PwrSeries(B, -0.8283, -4.409, 78.77, -343.9, 645.1, -454.4, 0.0, 0.0, 0.0, 0.0);
             V0   = 1.242518*EfieldScl;
             break;
         case 2:
             Ecen =-0.01163*pow(beta, -2.001) + 58.23;
             T    =-0.02166*pow(beta, -1.618) + 1.022;
-            Tp   = PwrSeries(beta,  11.25, -534.7,  3917, -1.313e4, 2.147e4, -1.389e4, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B,  11.25, -534.7,  3917, -1.313e4, 2.147e4, -1.389e4, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
-            Sp   = PwrSeries(beta, -0.8283, -4.409, 78.77, -343.9, 645.1, -454.4, 0.0, 0.0, 0.0, 0.0);
+            Sp   = PwrSeries(B, -0.8283, -4.409, 78.77, -343.9, 645.1, -454.4, 0.0, 0.0, 0.0, 0.0);
             V0   = 1.242518*EfieldScl;
             break;
         default:
@@ -360,7 +496,7 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
     case 53:
         if (beta < 0.3 || beta > 0.6) {
             FLAME_LOG(DEBUG) << "*** TransFacts: CaviIonK out of Range " << cavilabel << "\n";
-            calTransfac(CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
+            tabTransfac(model->CavTTF.get(), true, *model->CavData, 2, gaplabel, CaviIonK, true, Ecen, T, Tp, S, Sp, V0);
             V0 *= EfieldScl;
             return;
         }
@@ -369,14 +505,14 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
             Ecen = 250.0; // [mm].
             T    = 0.0;
             Tp   = 0.0;
-            S    = PwrSeries(beta, -4.222, 26.64, -38.49, -17.73, 84.12, -52.93, 0.0, 0.0, 0.0, 0.0);
-            Sp   = PwrSeries(beta, -1261, -1.413e4, 5.702e4, -1.111e5, 1.075e5, -4.167e4, 0.0, 0.0 , 0.0, 0.0);
+            S    = PwrSeries(B, -4.222, 26.64, -38.49, -17.73, 84.12, -52.93, 0.0, 0.0, 0.0, 0.0);
+            Sp   = PwrSeries(B, -1261, -1.413e4, 5.702e4, -1.111e5, 1.075e5, -4.167e4, 0.0, 0.0 , 0.0, 0.0);
             V0   = 4.25756986*EfieldScl;
             break;
         case 1:
             Ecen = 0.01219*pow(beta, -2.348) + 137.8;
             T    = 0.04856*pow(beta, -1.68) - 1.018;
-            Tp   = PwrSeries(beta, -3.612, 422.8, -1973, 4081, -4109, 1641, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, -3.612, 422.8, -1973, 4081, -4109, 1641, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
             Sp   = -0.03969*pow(beta, -1.775) +0.009034;
             V0   = 2.12878493*EfieldScl;
@@ -384,7 +520,7 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
         case 2:
             Ecen = -0.01219*pow(beta, -2.348) + 112.2;
             T    = -0.04856*pow(beta, -1.68) + 1.018;
-            Tp   = PwrSeries(beta, 3.612, -422.8, 1973, -4081, 4109, -1641, 0.0, 0.0, 0.0, 0.0);
+            Tp   = PwrSeries(B, 3.612, -422.8, 1973, -4081, 4109, -1641, 0.0, 0.0, 0.0, 0.0);
             S    = 0.0;
             Sp   = -0.03969*pow(beta, -1.775) +0.009034;
             V0   = 2.12878493*EfieldScl;
@@ -407,11 +543,20 @@ void ElementRFCavity::TransFacts(const int cavilabel, double beta, const double
 void ElementRFCavity::TransitFacMultipole(const int cavi, const std::string &flabel, const double CaviIonK,
                                           double &T, double &S) const
 {
+    TransitFacMultipole(cavi, flabel, fit_arg(CaviIonK), T, S);
+}
+
+void ElementRFCavity::TransitFacMultipole(const int cavi, const std::string &flabel, const fit_arg& K,
+                                          double &T, double &S) const
+{
+    const double CaviIonK = K.x;
     double Ecen, Tp, Sp, V0;
 
     // For debugging of TTF function.
     if (forcettfcalc) {
-        calTransfac(mlptable, get_column(flabel), 0, CaviIonK, false, Ecen, T, Tp, S, Sp, V0);
+        const int column = get_column(flabel);
+        tabTransfac(column<(int)model->MlpTTF.size() ? model->MlpTTF[column].get() : NULL, false,
+                    *model->mlptable, column, 0, CaviIonK, false, Ecen, T, Tp, S, Sp, V0);
         return;
     }
 
@@ -420,78 +565,80 @@ void ElementRFCavity::TransitFacMultipole(const int cavi, const std::string &fla
         ((cavi == 3) && (CaviIonK < 0.01687155 || CaviIonK > 0.0449908)) ||
         ((cavi == 4) && (CaviIonK < 0.0112477 || CaviIonK > 0.0224954))) {
         FLAME_LOG(DEBUG) << "*** TransitFacMultipole: CaviIonK out of Range" << "\n";
-        calTransfac(mlptable, get_column(flabel), 0, CaviIonK, false, Ecen, T, Tp, S, Sp, V0);
+        const int column = get_column(flabel);
+        tabTransfac(column<(int)model->MlpTTF.size() ? model->MlpTTF[column].get() : NULL, true,
+                    *model->mlptable, column, 0, CaviIonK, false, Ecen, T, Tp, S, Sp, V0);
         return;
     }
 
     if (flabel == "CaviMlp_EFocus1") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, 1.256386e+02, -3.108322e+04, 3.354464e+06, -2.089452e+08, 8.280687e+09, -2.165867e+11,
+            T = PwrSeries(K, 1.256386e+02, -3.108322e+04, 3.354464e+06, -2.089452e+08, 8.280687e+09, -2.165867e+11,
                           3.739846e+12, -4.112154e+13, 2.613462e14, -7.316972e14);
-            S = PwrSeries(CaviIonK, 1.394183e+02, -3.299673e+04, 3.438044e+06, -2.070369e+08, 7.942886e+09, -2.013750e+11,
+            S = PwrSeries(K, 1.394183e+02, -3.299673e+04, 3.438044e+06, -2.070369e+08, 7.942886e+09, -2.013750e+11,
                          3.374738e+12, -3.605780e+13, 2.229446e+14, -6.079177e+14);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, -9.450041e-01, -3.641390e+01, 9.926186e+03, -1.449193e+06, 1.281752e+08, -7.150297e+09,
+            T = PwrSeries(K, -9.450041e-01, -3.641390e+01, 9.926186e+03, -1.449193e+06, 1.281752e+08, -7.150297e+09,
                           2.534164e+11, -5.535252e+12, 6.794778e+13, -3.586197e+14);
-            S = PwrSeries(CaviIonK, 9.928055e-02, -5.545119e+01, 1.280168e+04, -1.636888e+06, 1.279801e+08, -6.379800e+09,
+            S = PwrSeries(K, 9.928055e-02, -5.545119e+01, 1.280168e+04, -1.636888e+06, 1.279801e+08, -6.379800e+09,
                           2.036575e+11, -4.029152e+12, 4.496323e+13, -2.161712e+14);
             break;
         case 3:
-            T = PwrSeries(CaviIonK, -1.000000e+00, 2.778823e-07, 6.820327e+01, 4.235106e-03, -1.926935e+03, 1.083516e+01,
+            T = PwrSeries(K, -1.000000e+00, 2.778823e-07, 6.820327e+01, 4.235106e-03, -1.926935e+03, 1.083516e+01,
                           2.996807e+04, 6.108642e+03, -3.864554e+05, 6.094390e+05);
-            S = PwrSeries(CaviIonK, -4.530303e-10, 1.625011e-07, -2.583224e-05, 2.478684e+01, -1.431967e-01, -1.545412e+03,
+            S = PwrSeries(K, -4.530303e-10, 1.625011e-07, -2.583224e-05, 2.478684e+01, -1.431967e-01, -1.545412e+03,
                           -1.569820e+02, 3.856713e+04, -3.159828e+04, -2.700076e+05);
 
             break;
         case 4:
-            T = PwrSeries(CaviIonK, -1.000000e+00, -2.406447e-07, 9.480040e+01, -7.659927e-03, -4.926996e+03, -3.504383e+01,
+            T = PwrSeries(K, -1.000000e+00, -2.406447e-07, 9.480040e+01, -7.659927e-03, -4.926996e+03, -3.504383e+01,
                           1.712590e+05, -1.964643e+04, -4.142976e+06, 6.085390e+06);
-            S = PwrSeries(CaviIonK, 3.958048e-11, -2.496811e-08, 7.027794e-06, -8.662787e+01, 1.246098e-01, 9.462491e+03,
+            S = PwrSeries(K, 3.958048e-11, -2.496811e-08, 7.027794e-06, -8.662787e+01, 1.246098e-01, 9.462491e+03,
                           4.481784e+02, -4.552412e+05, 3.026543e+05, 8.798256e+06);
             break;
         }
     } else if (flabel == "CaviMlp_EFocus2") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, 1.038803e+00, -9.121320e+00, 8.943931e+02, -5.619149e+04, 2.132552e+06, -5.330725e+07,
+            T = PwrSeries(K, 1.038803e+00, -9.121320e+00, 8.943931e+02, -5.619149e+04, 2.132552e+06, -5.330725e+07,
                           8.799404e+08, -9.246033e+09, 5.612073e+10, -1.499544e+11);
-            S = PwrSeries(CaviIonK, 1.305154e-02, -2.585211e+00, 2.696971e+02, -1.488249e+04, 5.095765e+05, -1.154148e+07,
+            S = PwrSeries(K, 1.305154e-02, -2.585211e+00, 2.696971e+02, -1.488249e+04, 5.095765e+05, -1.154148e+07,
                           1.714580e+08, -1.604935e+09, 8.570757e+09, -1.983302e+10);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, 9.989307e-01, 7.299233e-01, -2.932580e+02, 3.052166e+04, -2.753614e+06, 1.570331e+08,
+            T = PwrSeries(K, 9.989307e-01, 7.299233e-01, -2.932580e+02, 3.052166e+04, -2.753614e+06, 1.570331e+08,
                           -5.677804e+09, 1.265012e+11, -1.584238e+12, 8.533351e+12);
-            S = PwrSeries(CaviIonK, -3.040839e-03, 2.016667e+00, -4.313590e+02, 5.855139e+04, -4.873584e+06, 2.605444e+08,
+            S = PwrSeries(K, -3.040839e-03, 2.016667e+00, -4.313590e+02, 5.855139e+04, -4.873584e+06, 2.605444e+08,
                           -8.968899e+09, 1.923697e+11, -2.339920e+12, 1.233014e+13);
             break;
         case 3:
-            T = PwrSeries(CaviIonK, 1.000000e+00, -4.410575e-06, -8.884752e+01, -7.927594e-02, 4.663277e+03, -2.515405e+02,
+            T = PwrSeries(K, 1.000000e+00, -4.410575e-06, -8.884752e+01, -7.927594e-02, 4.663277e+03, -2.515405e+02,
                          -1.797134e+05, -1.904305e+05, 8.999378e+06, -2.951362e+07);
-            S = PwrSeries(CaviIonK, 6.387813e-08, -2.300899e-05, 3.676251e-03, -1.703282e+02, 2.066461e+01, 1.704569e+04,
+            S = PwrSeries(K, 6.387813e-08, -2.300899e-05, 3.676251e-03, -1.703282e+02, 2.066461e+01, 1.704569e+04,
                           2.316653e+04, -1.328926e+06, 4.853676e+06, 1.132796e+06);
 
             break;
         case 4:
-            T = PwrSeries(CaviIonK, 1.000000e+00, -5.025186e-06, -1.468976e+02, -2.520376e-01,2.048799e+04, -2.224267e+03,
+            T = PwrSeries(K, 1.000000e+00, -5.025186e-06, -1.468976e+02, -2.520376e-01,2.048799e+04, -2.224267e+03,
                           -2.532091e+06, -4.613480e+06, 3.611911e+08, -1.891951e+09);
-            S = PwrSeries(CaviIonK, -1.801149e-08, 1.123280e-05, -3.126902e-03, 4.655245e+02, -5.431878e+01, -1.477730e+05,
+            S = PwrSeries(K, -1.801149e-08, 1.123280e-05, -3.126902e-03, 4.655245e+02, -5.431878e+01, -1.477730e+05,
                           -1.922110e+05, 2.795761e+07, -1.290046e+08, -4.656951e+08);
             break;
         }
     } else if (flabel == "CaviMlp_EDipole") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, -1.005885e+00, 1.526489e+00, -1.047651e+02, 1.125013e+04, -4.669147e+05, 1.255841e+07,
+            T = PwrSeries(K, -1.005885e+00, 1.526489e+00, -1.047651e+02, 1.125013e+04, -4.669147e+05, 1.255841e+07,
                           -2.237287e+08, 2.535541e+09, -1.656906e+10, 4.758398e+10);
-            S = PwrSeries(CaviIonK, -2.586200e-02, 5.884367e+00, -6.407538e+02, 3.888964e+04, -1.488484e+06, 3.782592e+07,
+            S = PwrSeries(K, -2.586200e-02, 5.884367e+00, -6.407538e+02, 3.888964e+04, -1.488484e+06, 3.782592e+07,
                           -6.361033e+08, 6.817810e+09, -4.227114e+10, 1.155597e+11);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, -9.999028e-01, -6.783669e-02, 1.415756e+02, -2.950990e+03, 2.640980e+05, -1.570742e+07,
+            T = PwrSeries(K, -9.999028e-01, -6.783669e-02, 1.415756e+02, -2.950990e+03, 2.640980e+05, -1.570742e+07,
                           5.770450e+08, -1.303686e+10, 1.654958e+11, -9.030017e+11);
-            S = PwrSeries(CaviIonK, 2.108581e-04, -3.700608e-01, 2.851611e+01, -3.502994e+03, 2.983061e+05, -1.522679e+07,
+            S = PwrSeries(K, 2.108581e-04, -3.700608e-01, 2.851611e+01, -3.502994e+03, 2.983061e+05, -1.522679e+07,
                           4.958029e+08, -1.002040e+10, 1.142835e+11, -5.617061e+11);
             break;
         default:
@@ -503,69 +650,69 @@ void ElementRFCavity::TransitFacMultipole(const int cavi, const std::string &fla
     } else if (flabel == "CaviMlp_EQuad") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, 1.038941e+00, -9.238897e+00, 9.127945e+02, -5.779110e+04, 2.206120e+06, -5.544764e+07,
+            T = PwrSeries(K, 1.038941e+00, -9.238897e+00, 9.127945e+02, -5.779110e+04, 2.206120e+06, -5.544764e+07,
                           9.192347e+08, -9.691159e+09, 5.896915e+10, -1.578312e+11);
-            S = PwrSeries(CaviIonK, 1.248096e-01, -2.923507e+01, 3.069331e+03, -1.848380e+05, 7.094882e+06, -1.801113e+08,
+            S = PwrSeries(K, 1.248096e-01, -2.923507e+01, 3.069331e+03, -1.848380e+05, 7.094882e+06, -1.801113e+08,
                           3.024208e+09, -3.239241e+10, 2.008767e+11, -5.496217e+11);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, 1.000003e+00, -1.015639e-03, -1.215634e+02, 1.720764e+01, 3.921401e+03, 2.674841e+05,
+            T = PwrSeries(K, 1.000003e+00, -1.015639e-03, -1.215634e+02, 1.720764e+01, 3.921401e+03, 2.674841e+05,
                           -1.236263e+07, 3.128128e+08, -4.385795e+09, 2.594631e+10);
-            S = PwrSeries(CaviIonK, -1.756250e-05, 2.603597e-01, -2.551122e+00, -4.840638e+01, -2.870201e+04, 1.552398e+06,
+            S = PwrSeries(K, -1.756250e-05, 2.603597e-01, -2.551122e+00, -4.840638e+01, -2.870201e+04, 1.552398e+06,
                           -5.135200e+07, 1.075958e+09, -1.277425e+10, 6.540748e+10);
             break;
         case 3:
-            T = PwrSeries(CaviIonK, 1.000000e+00, 6.239107e-06, -1.697479e+02, 3.444883e-02, 1.225241e+04, -1.663533e+02,
+            T = PwrSeries(K, 1.000000e+00, 6.239107e-06, -1.697479e+02, 3.444883e-02, 1.225241e+04, -1.663533e+02,
                           -5.526645e+05, -3.593353e+05, 2.749580e+07, -9.689870e+07);
-            S = PwrSeries(CaviIonK, 2.128708e-07, -7.985618e-05, 1.240259e-02, -3.211339e+02, 7.098731e+01, 3.474652e+04,
+            S = PwrSeries(K, 2.128708e-07, -7.985618e-05, 1.240259e-02, -3.211339e+02, 7.098731e+01, 3.474652e+04,
                           8.187145e+04, -3.731688e+06, 1.802053e+07, -1.819958e+07);
             break;
         case 4:
-            T = PwrSeries(CaviIonK, 9.998746e-01, -2.431292e-05, -5.019138e+02, -1.176338e+00, 1.006054e+05, -9.908805e+03,
+            T = PwrSeries(K, 9.998746e-01, -2.431292e-05, -5.019138e+02, -1.176338e+00, 1.006054e+05, -9.908805e+03,
                           -1.148028e+07, -1.922707e+07, 1.432258e+09, -7.054482e+09);
-            S = PwrSeries(CaviIonK, 6.003340e-08, -1.482633e-02, 1.037590e-02, -2.235440e+03, 1.790006e+02, 6.456882e+05,
+            S = PwrSeries(K, 6.003340e-08, -1.482633e-02, 1.037590e-02, -2.235440e+03, 1.790006e+02, 6.456882e+05,
                           6.261020e+05, -1.055477e+08, 4.110502e+08, 2.241301e+09);
             break;
         }
     } else if (flabel == "CaviMlp_HMono") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, 1.703336e+00, -1.671357e+02, 1.697657e+04, -9.843253e+05, 3.518178e+07, -8.043084e+08,
+            T = PwrSeries(K, 1.703336e+00, -1.671357e+02, 1.697657e+04, -9.843253e+05, 3.518178e+07, -8.043084e+08,
                           1.165760e+10, -1.014721e+11, 4.632851e+11, -7.604796e+11);
-            S = PwrSeries(CaviIonK, 1.452657e+01, -3.409550e+03, 3.524921e+05, -2.106663e+07, 8.022856e+08,
+            S = PwrSeries(K, 1.452657e+01, -3.409550e+03, 3.524921e+05, -2.106663e+07, 8.022856e+08,
                           -2.019481e+10, 3.360597e+11, -3.565836e+12, 2.189668e+13, -5.930241e+13);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, 1.003228e+00, -1.783406e+00, 1.765330e+02, -5.326467e+04, 4.242623e+06, -2.139672e+08,
+            T = PwrSeries(K, 1.003228e+00, -1.783406e+00, 1.765330e+02, -5.326467e+04, 4.242623e+06, -2.139672e+08,
                           6.970488e+09, -1.411958e+11, 1.617248e+12, -8.000662e+12);
-            S = PwrSeries(CaviIonK, -1.581533e-03, 1.277444e+00, -2.742508e+02, 3.966879e+04, -3.513478e+06, 1.962939e+08,
+            S = PwrSeries(K, -1.581533e-03, 1.277444e+00, -2.742508e+02, 3.966879e+04, -3.513478e+06, 1.962939e+08,
                           -6.991916e+09, 1.539708e+11, -1.910236e+12, 1.021016e+13);
             break;
         case 3:
-            T = PwrSeries(CaviIonK, 9.999990e-01, 3.477993e-04, -2.717994e+02, 4.554376e+00, 3.083481e+04, 8.441315e+03,
+            T = PwrSeries(K, 9.999990e-01, 3.477993e-04, -2.717994e+02, 4.554376e+00, 3.083481e+04, 8.441315e+03,
                           -2.439843e+06, 1.322379e+06, 1.501750e+08, -6.822135e+08);
-            S = PwrSeries(CaviIonK, 1.709084e-06, -6.240506e-04, 1.013278e-01, -2.649338e+02, 5.944163e+02,
+            S = PwrSeries(K, 1.709084e-06, -6.240506e-04, 1.013278e-01, -2.649338e+02, 5.944163e+02,
                           4.588900e+04, 7.110518e+05, -2.226574e+07, 1.658524e+08, -3.976459e+08);
             break;
         case 4:
-            T = PwrSeries(CaviIonK, 1.000000e+00, -4.358956e-05, -7.923870e+02, -2.472669e+00, 2.241378e+05, -2.539286e+04,
+            T = PwrSeries(K, 1.000000e+00, -4.358956e-05, -7.923870e+02, -2.472669e+00, 2.241378e+05, -2.539286e+04,
                           -3.385480e+07, -6.375134e+07, 5.652166e+09, -3.355877e+10);
-            S = PwrSeries(CaviIonK, 1.163146e-07, -7.302018e-05, 2.048587e-02, -3.689694e+02, 3.632907e+02, 1.757838e+05,
+            S = PwrSeries(K, 1.163146e-07, -7.302018e-05, 2.048587e-02, -3.689694e+02, 3.632907e+02, 1.757838e+05,
                           1.327057e+06, -9.520645e+07, 9.406709e+08, -2.139562e+09);
             break;
         }
     } else if (flabel == "CaviMlp_HDipole") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, 6.853803e-01, 7.075414e+01, -7.117391e+03, 3.985674e+05, -1.442888e+07, 3.446369e+08,
+            T = PwrSeries(K, 6.853803e-01, 7.075414e+01, -7.117391e+03, 3.985674e+05, -1.442888e+07, 3.446369e+08,
                           -5.420826e+09, 5.414689e+10, -3.116216e+11, 7.869717e+11);
-            S = PwrSeries(CaviIonK, 1.021102e+00, -2.441117e+02, 2.575274e+04, -1.569273e+06, 6.090118e+07, -1.562284e+09,
+            S = PwrSeries(K, 1.021102e+00, -2.441117e+02, 2.575274e+04, -1.569273e+06, 6.090118e+07, -1.562284e+09,
                           2.649289e+10, -2.864139e+11, 1.791634e+12, -4.941947e+12);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, 1.014129e+00, -8.016304e+00, 1.631339e+03, -2.561826e+05, 2.115355e+07, -1.118723e+09,
+            T = PwrSeries(K, 1.014129e+00, -8.016304e+00, 1.631339e+03, -2.561826e+05, 2.115355e+07, -1.118723e+09,
                           3.821029e+10, -8.140248e+11, 9.839613e+12, -5.154137e+13);
-            S = PwrSeries(CaviIonK, -4.688714e-03, 3.299051e+00, -8.101936e+02, 1.163814e+05, -1.017331e+07, 5.607330e+08,
+            S = PwrSeries(K, -4.688714e-03, 3.299051e+00, -8.101936e+02, 1.163814e+05, -1.017331e+07, 5.607330e+08,
                           -1.967300e+10, 4.261388e+11, -5.194592e+12, 2.725370e+13);
             break;
         default:
@@ -577,27 +724,27 @@ void ElementRFCavity::TransitFacMultipole(const int cavi, const std::string &fla
     } else if (flabel == "CaviMlp_HQuad") {
         switch (cavi) {
         case 1:
-            T = PwrSeries(CaviIonK, -1.997432e+00, 2.439177e+02, -2.613724e+04, 1.627837e+06, -6.429625e+07, 1.676173e+09,
+            T = PwrSeries(K, -1.997432e+00, 2.439177e+02, -2.613724e+04, 1.627837e+06, -6.429625e+07, 1.676173e+09,
                           -2.885455e+10, 3.163675e+11, -2.005326e+12, 5.600545e+12);
-            S = PwrSeries(CaviIonK, -2.470704e+00, 5.862902e+02, -6.135071e+04, 3.711527e+06, -1.431267e+08, 3.649414e+09,
+            S = PwrSeries(K, -2.470704e+00, 5.862902e+02, -6.135071e+04, 3.711527e+06, -1.431267e+08, 3.649414e+09,
                           -6.153570e+10, 6.617859e+11, -4.119861e+12, 1.131390e+13);
             break;
         case 2:
-            T = PwrSeries(CaviIonK, -1.000925e+00, 5.170302e-01, 9.311761e+01, 1.591517e+04, -1.302247e+06, 6.647808e+07,
+            T = PwrSeries(K, -1.000925e+00, 5.170302e-01, 9.311761e+01, 1.591517e+04, -1.302247e+06, 6.647808e+07,
                           -2.215417e+09, 4.603390e+10, -5.420873e+11, 2.764042e+12);
-            S = PwrSeries(CaviIonK, 3.119419e-04, -4.540868e-01, 5.433028e+01, -7.571946e+03, 6.792565e+05, -3.728390e+07,
+            S = PwrSeries(K, 3.119419e-04, -4.540868e-01, 5.433028e+01, -7.571946e+03, 6.792565e+05, -3.728390e+07,
                           1.299263e+09, -2.793705e+10, 3.377097e+11, -1.755126e+12);
             break;
         case 3:
-            T = PwrSeries(CaviIonK, -9.999997e-01, -1.049624e-04, 2.445420e+02, -1.288731e+00, -2.401575e+04, -1.972894e+03,
+            T = PwrSeries(K, -9.999997e-01, -1.049624e-04, 2.445420e+02, -1.288731e+00, -2.401575e+04, -1.972894e+03,
                           1.494708e+06, 2.898145e+05, -8.782506e+07, 3.566907e+08);
-            S = PwrSeries(CaviIonK, -7.925695e-07, 2.884963e-04, -4.667266e-02, 2.950936e+02, -2.712131e+02, -4.260259e+04,
+            S = PwrSeries(K, -7.925695e-07, 2.884963e-04, -4.667266e-02, 2.950936e+02, -2.712131e+02, -4.260259e+04,
                           -3.199682e+05, 1.103376e+07, -7.304474e+07, 1.479036e+08);
             break;
         case 4:
-            T = PwrSeries(CaviIonK, -1.000000e+00, 4.357777e-05, 7.605879e+02, 2.285787e+00, -2.009415e+05, 2.149581e+04,
+            T = PwrSeries(K, -1.000000e+00, 4.357777e-05, 7.605879e+02, 2.285787e+00, -2.009415e+05, 2.149581e+04,
                          2.773856e+07, 4.886782e+07, -4.127019e+09, 2.299278e+10);
-            S = PwrSeries(CaviIonK, -1.483304e-07, 9.278457e-05, -2.592071e-02, 1.690272e+03, -4.545599e+02, -6.192487e+05,
+            S = PwrSeries(K, -1.483304e-07, 9.278457e-05, -2.592071e-02, 1.690272e+03, -4.545599e+02, -6.192487e+05,
                           -1.632321e+06, 1.664856e+08, -1.124066e+09, -3.121299e+08);
             break;
         }
@@ -700,8 +847,9 @@ void  ElementRFCavity::LoadCavityFile(const Config& c)
 {
     fRF = c.get<double>("f");
     IonFys = c.get<double>("phi")*M_PI/180e0;
-    phi_ref = std::numeric_limits<double>::quiet_NaN();
     cRm = c.get<double>("Rm", 0.0);
+    SclFac = c.get<double>("scl_fac");
+    SyncFlag = c.get<double>("syncflag", 1.0);
     forcettfcalc = c.get<double>("forcettfcalc", 0.0)!=0.0;
     MpoleLevel = get_flag(c, "MpoleLevel", 2);
     EmitGrowth = get_flag(c, "EmitGrowth", 0);
@@ -744,233 +892,253 @@ void  ElementRFCavity::LoadCavityFile(const Config& c)
         throw std::runtime_error(SB()<<"*** InitRFCav: undef. cavity type: " << CavType);
     }
 
-    if (cavi != 0)
-    {
-        numeric_table_cache *cache = numeric_table_cache::get();
-
-        try{
-            numeric_table_cache::table_pointer ent = cache->fetch(fldmap);
-            CavData = *ent;
-            if(CavData.table.size1()==0 || CavData.table.size2()<2)
-                throw std::runtime_error("field map needs 2+ columns");
-        }catch(std::exception& e){
-            throw std::runtime_error(SB()<<"Error parsing '"<<fldmap<<"' : "<<e.what());
-        }
+    data_file_cache *cache = data_file_cache::get();
+    if (cavi != 0) {
+        data_file_cache::files_t files;
+        files.push_back(cavfile);
+        files.push_back(fldmap);
+        files.push_back(mlpfile);
+        model = cache->fetch<cavity_model>("rf_cavity", files, [&cavfile, &fldmap, &mlpfile]() {
+            std::shared_ptr<cavity_model> M(new cavity_model);
+            M->load(cavfile, fldmap, mlpfile);
+            return M;
+        });
+    } else {
+        model = cache->fetch<cavity_model>("rf_cavity_generic", data_file_cache::files_t(1, DataFile), [this]() {
+            std::shared_ptr<cavity_model> M(new cavity_model);
+            M->load_generic(DataFile);
+            return M;
+        });
+    }
 
-        try{
-            numeric_table_cache::table_pointer ent = cache->fetch(mlpfile);
-            mlptable = *ent;
-            if(mlptable.table.size1()==0 || mlptable.table.size2()<7)
-                throw std::runtime_error("CaviMlp needs 7+ columns");
-        }catch(std::exception& e){
-            throw std::runtime_error(SB()<<"Error parsing '"<<mlpfile<<"' : "<<e.what());
-        }
+    if (model->have_Rm)
+        cRm = model->Rm;
+}
 
-        {
-            std::ifstream fstrm(cavfile.c_str());
-
-            std::string rawline;
-            unsigned line=0;
-            while(std::getline(fstrm, rawline)) {
-                line++;
-
-                size_t cpos = rawline.find_first_not_of(" \t");
-                if(cpos==rawline.npos || rawline[cpos]=='%')
-                    continue; // skip blank and comment lines
-
-                cpos = rawline.find_last_not_of("\r\n");
-                if(cpos!=rawline.npos)
-                    rawline = rawline.substr(0, cpos+1);
-
-                std::istringstream lstrm(rawline);
-                RawParams params;
-                lstrm >> params.type >> params.name >> params.length >> params.aperature;
-                bool needE0 = params.type!="drift" && params.type!="AccGap";
-                if(needE0)
-                    lstrm >> params.E0;
-                else
-                    params.E0 = 0.0;
-
-                if(lstrm.fail() && !lstrm.eof()) {
-                    throw std::runtime_error(SB()<<"Error parsing line '"<<line<<"' in '"<<cavfile<<"'");
-                }
-                lattice.push_back(params);
-            }
+void ElementRFCavity::cavity_model::load(const std::string& cavfile, const std::string& fldmap, const std::string& mlpfile)
+{
+    numeric_table_cache *cache = numeric_table_cache::get();
+
+    try{
+        numeric_table_cache::table_pointer ent = cache->fetch(fldmap);
+        CavData = ent;
+        if(CavData->table.size1()==0 || CavData->table.size2()<2)
+            throw std::runtime_error("field map needs 2+ columns");
+        CavTTF.reset(new ttf_table(*ent, 2, true));
+    }catch(std::exception& e){
+        throw std::runtime_error(SB()<<"Error parsing '"<<fldmap<<"' : "<<e.what());
+    }
 
-            if(fstrm.fail() && !fstrm.eof()) {
-                throw std::runtime_error(SB()<<"Error, extra chars at end of file (line "<<line<<") in '"<<cavfile<<"'");
-            }
-        }
+    try{
+        numeric_table_cache::table_pointer ent = cache->fetch(mlpfile);
+        mlptable = ent;
+        if(mlptable->table.size1()==0 || mlptable->table.size2()<7)
+            throw std::runtime_error("CaviMlp needs 7+ columns");
+        // columns of get_column()
+        MlpTTF.resize(9);
+        for(size_t col=2; col<MlpTTF.size() && col<=mlptable->table.size2(); col++)
+            MlpTTF[col].reset(new ttf_table(*ent, col, false));
+    }catch(std::exception& e){
+        throw std::runtime_error(SB()<<"Error parsing '"<<mlpfile<<"' : "<<e.what());
     }
-    else
+
     {
-        std::shared_ptr<Config> conf;
-        std::string key(SB()<<DataFile<<"|"<<boost::filesystem::last_write_time(DataFile));
-        if ( CavConfMap.find(key) == CavConfMap.end() ) {
-            // not found in CavConfMap
-            try {
-                try {
-                    GLPSParser P;
-                    conf.reset(P.parse_file(DataFile.c_str()));
-                }catch(std::exception& e){
-                    std::cerr<<"Parse error: "<<e.what()<<"\n";
-                }
+        std::ifstream fstrm(cavfile.c_str());
+
+        std::string rawline;
+        unsigned line=0;
+        while(std::getline(fstrm, rawline)) {
+            line++;
+
+            size_t cpos = rawline.find_first_not_of(" \t");
+            if(cpos==rawline.npos || rawline[cpos]=='%')
+                continue; // skip blank and comment lines
+
+            cpos = rawline.find_last_not_of("\r\n");
+            if(cpos!=rawline.npos)
+                rawline = rawline.substr(0, cpos+1);
 
-            }catch(std::exception& e){
-                std::cerr<<"Error: "<<e.what()<<"\n";
+            std::istringstream lstrm(rawline);
+            RawParams params;
+            lstrm >> params.type >> params.name >> params.length >> params.aperature;
+            bool needE0 = params.type!="drift" && params.type!="AccGap";
+            if(needE0)
+                lstrm >> params.E0;
+            else
+                params.E0 = 0.0;
+
+            if(lstrm.fail() && !lstrm.eof()) {
+                throw std::runtime_error(SB()<<"Error parsing line '"<<line<<"' in '"<<cavfile<<"'");
             }
-            CavConfMap.insert(std::make_pair(key, conf));
-        } else {
-            // found in CavConfMap
-            conf=CavConfMap[key];
+            lattice.push_back(params);
         }
 
-        typedef Config::vector_t elements_t;
-        elements_t Es(conf->get<elements_t>("elements"));
-        for(elements_t::iterator it=Es.begin(), end=Es.end(); it!=end; ++it)
+        if(fstrm.fail() && !fstrm.eof()) {
+            throw std::runtime_error(SB()<<"Error, extra chars at end of file (line "<<line<<") in '"<<cavfile<<"'");
+        }
+    }
+}
+
+void ElementRFCavity::cavity_model::load_generic(const std::string& DataFile)
+{
+    std::shared_ptr<Config> conf;
+    try {
+        GLPSParser P;
+        conf.reset(P.parse_file(DataFile.c_str()));
+    }catch(std::exception& e){
+        throw std::runtime_error(SB()<<"Error parsing '"<<DataFile<<"' : "<<e.what());
+    }
+
+    typedef Config::vector_t elements_t;
+    elements_t Es(conf->get<elements_t>("elements"));
+    for(elements_t::iterator it=Es.begin(), end=Es.end(); it!=end; ++it)
+    {
+        const Config& EC = *it;
+        const std::string& etype(EC.get<std::string>("type"));
+        const double elength(EC.get<double>("L"));
+        // fill in the lattice
+        RawParams params;
+        params.type = etype;
+        params.length = elength;
+        std::vector<double> attrs;
+        bool notdrift = etype!="drift";
+        if(notdrift)
         {
-            const Config& EC = *it;
-            const std::string& etype(EC.get<std::string>("type"));
-            const double elength(EC.get<double>("L"));
-            // fill in the lattice
-            RawParams params;
-            params.type = etype;
-            params.length = elength;
-            std::vector<double> attrs;
-            bool notdrift = etype!="drift";
-            if(notdrift)
+            const double eV0(EC.get<double>("V0"));
+            params.E0 = eV0;
+            EC.tryGet<std::vector<double> >("attr", attrs);
+            for(int i=0; i<10; i++)
             {
-                const double eV0(EC.get<double>("V0"));
-                params.E0 = eV0;
-                EC.tryGet<std::vector<double> >("attr", attrs);
-                for(int i=0; i<10; i++)
-                {
-                    params.Tfit.push_back(attrs[i]);
-                }
-                for(int i=0; i<10; i++)
-                {
-                    params.Sfit.push_back(attrs[i+10]);
-                }
+                params.Tfit.push_back(attrs[i]);
             }
-            bool needSynAccTab = params.type=="AccGap";
-            // SynAccTab should only update once
-            if(needSynAccTab && SynAccTab.size()==0)
+            for(int i=0; i<10; i++)
             {
-                for(int i=0; i<3; i++)
-                {
-                    SynAccTab.push_back(attrs[i+20]);
-                }
-             }
-            lattice.push_back(params);
+                params.Sfit.push_back(attrs[i+10]);
+            }
         }
-
-        std::vector<double> Ez;
-        bool checker = conf->tryGet<std::vector<double> >("Ez", Ez);
-        if (!checker) throw std::runtime_error(SB()<<"'Ez' is missing in RF cavity file.\n");
-        CavData.readvec(Ez,2);
-        conf->tryGet<double>("Rm",cRm);
-
-        // Get extra parameters for complex synchronous phase definition
-        have_RefNrm = conf->tryGet<double>("RefNorm", RefNrm);
-        have_SynComplex = conf->tryGet<std::vector<double> >("SyncFit", SynComplex);
-        have_EkLim = conf->tryGet<std::vector<double> >("EnergyLimit", EkLim);
-        have_NrLim = conf->tryGet<std::vector<double> >("NormLimit", NrLim);
+        bool needSynAccTab = params.type=="AccGap";
+        // SynAccTab should only update once
+        if(needSynAccTab && SynAccTab.size()==0)
+        {
+            for(int i=0; i<3; i++)
+            {
+                SynAccTab.push_back(attrs[i+20]);
+            }
+         }
+        lattice.push_back(params);
     }
+
+    std::vector<double> Ez;
+    bool checker = conf->tryGet<std::vector<double> >("Ez", Ez);
+    if (!checker) throw std::runtime_error(SB()<<"'Ez' is missing in RF cavity file.\n");
+    std::shared_ptr<numeric_table> table(new numeric_table);
+    table->readvec(Ez,2);
+    CavData = table;
+    have_Rm = conf->tryGet<double>("Rm", Rm);
+
+    // Get extra parameters for complex synchronous phase definition
+    have_RefNrm = conf->tryGet<double>("RefNorm", RefNrm);
+    have_SynComplex = conf->tryGet<std::vector<double> >("SyncFit", SynComplex);
+    have_EkLim = conf->tryGet<std::vector<double> >("EnergyLimit", EkLim);
+    have_NrLim = conf->tryGet<std::vector<double> >("NormLimit", NrLim);
 }
 
 void  ElementRFCavity::GetCavMatParams(const int cavi, const double beta_tab[], const double gamma_tab[], const double CaviIonK[],
                                        CavTLMLineType& lineref) const
 {
-    if(lattice.empty())
+    if(model->lattice.empty())
         throw std::runtime_error("empty RF cavity lattice");
 
     lineref.clear();
 
+    // the multipole fits of each gap are evaluated at the same point
+    const fit_arg K[2] = {fit_arg(CaviIonK[0]), fit_arg(CaviIonK[1])};
+
     size_t i;
-    double s=CavData.table(0,0);
-    for(i=0; i<lattice.size(); i++) {
-        const RawParams& P = lattice[i];
+    double s=model->CavData->table(0,0);
+    for(i=0; i<model->lattice.size(); i++) {
+        const RawParams& P = model->lattice[i];
         {
             double      E0=0.0, T=0.0, S=0.0, Accel=0.0;
 
             if ((P.type != "drift") && (P.type != "AccGap"))
                 E0 = P.E0;
 
-            s+=lattice[i].length;
+            s+=model->lattice[i].length;
 
             if (P.type == "drift") {
             } else if (P.type == "EFocus1") {
                 if (s < 0e0) {
                     // First gap. By reflection 1st Gap EFocus1 is 2nd gap EFocus2.
-                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus2", CaviIonK[0], T, S);
+                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus2", K[0], T, S);
                     // First gap *1, transverse E field the same.
                     S = -S;
                 } else {
                     // Second gap.
-                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus1", CaviIonK[1], T, S);
+                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus1", K[1], T, S);
                 }
             } else if (P.type == "EFocus2") {
                 if (s < 0e0) {
                     // First gap.
-                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus1", CaviIonK[0], T, S);
+                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus1", K[0], T, S);
                     S = -S;
                 } else {
                     // Second gap.
-                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus2", CaviIonK[1], T, S);
+                    ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EFocus2", K[1], T, S);
                 }
             } else if (P.type == "EDipole") {
                 if (MpoleLevel >= 1) {
                     if (s < 0e0) {
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EDipole", CaviIonK[0], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EDipole", K[0], T, S);
                         // First gap *1, transverse E field the same.
                         S = -S;
                     } else {
                         // Second gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EDipole", CaviIonK[1], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EDipole", K[1], T, S);
                     }
                 }
             } else if (P.type == "EQuad") {
                 if (MpoleLevel >= 2) {
                     if (s < 0e0) {
                         // First gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EQuad", CaviIonK[0], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EQuad", K[0], T, S);
                         S = -S;
                     } else {
                         // Second Gap
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EQuad", CaviIonK[1], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_EQuad", K[1], T, S);
                     }
                 }
             } else if (P.type == "HMono") {
                 if (MpoleLevel >= 2) {
                     if (s < 0e0) {
                         // First gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HMono", CaviIonK[0], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HMono", K[0], T, S);
                         T = -T;
                     } else {
                         // Second Gap
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HMono", CaviIonK[1], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HMono", K[1], T, S);
                     }
                 }
             } else if (P.type == "HDipole") {
                 if (MpoleLevel >= 1) {
                     if (s < 0e0) {
                         // First gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HDipole", CaviIonK[0], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HDipole", K[0], T, S);
                         T = -T;
                     }  else {
                         // Second gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HDipole", CaviIonK[1], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HDipole", K[1], T, S);
                     }
                 }
             } else if (P.type == "HQuad") {
                 if (MpoleLevel >= 2) {
                     if (s < 0e0) {
                         // First gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HQuad", CaviIonK[0], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HQuad", K[0], T, S);
                         T = -T;
                     } else {
                         // Second gap.
-                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HQuad", CaviIonK[1], T, S);
+                        ElementRFCavity::TransitFacMultipole(cavi, "CaviMlp_HQuad", K[1], T, S);
                     }
                 }
             } else if (P.type == "AccGap") {
@@ -1018,8 +1186,6 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
     const double IonA = 1e0;
 
-    using boost::numeric::ublas::prod;
-
     Idmat = boost::numeric::ublas::identity_matrix<double>(PS_Dim);
 
     k_s[0] = 2e0*M_PI/(beta_tab[0]*Lambda);
@@ -1062,10 +1228,10 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
     Mlon_L3       = Idmat;
     Mlon_L3(4, 5) = -2e0*M_PI/Lambda*(1e0/cube(beta_tab[2]*gamma_tab[2])*MeVtoeV/real.IonEs*L3);
 
-    Mlon = prod(Mlon_K1, Mlon_L1);
-    Mlon = prod(Mlon_L2, Mlon);
-    Mlon = prod(Mlon_K2, Mlon);
-    Mlon = prod(Mlon_L3, Mlon);
+    MatMult(Mlon_K1, Mlon_L1, Mlon);
+    MatMultLeft(Mlon_L2, Mlon);
+    MatMultLeft(Mlon_K2, Mlon);
+    MatMultLeft(Mlon_L3, Mlon);
 //    std::cout<<__FUNCTION__<<" Mlon "<<Mlon<<"\n";
 
     // Transverse model
@@ -1083,11 +1249,11 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
     V0 = 0e0, T = 0e0, S = 0e0, kfdx = 0e0, kfdy = 0e0, dpy = 0e0;
     size_t n;
-    double s=CavData.table(0,0);
-    for(n=0; n<lattice.size(); n++) {
-        const RawParams& P = lattice[n];
+    double s=model->CavData->table(0,0);
+    for(n=0; n<model->lattice.size(); n++) {
+        const RawParams& P = model->lattice[n];
 
-        s+=lattice[n].length;
+        s+=model->lattice[n].length;
 
         if (false)
             printf("%9.5f %8s %8s %9.5f %9.5f %9.5f\n",
@@ -1099,7 +1265,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
             Mprob(0, 1) = P.length;
             Mprob(2, 3) = P.length;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
         } else if (P.type == "EFocus1") {
             V0   = linetab.E0[n]*EfieldScl;
             T    = linetab.T[n];
@@ -1114,7 +1280,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
             Mprob(1, 0) = kfdx;
             Mprob(3, 2) = kfdy;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
         } else if (P.type == "EFocus2") {
             V0   = linetab.E0[n]*EfieldScl;
             T    = linetab.T[n];
@@ -1125,7 +1291,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
             Mprob(1, 0) = kfdx;
             Mprob(3, 2) = kfdy;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
         } else if (P.type == "EDipole") {
             if (MpoleLevel >= 1) {
                 V0  = linetab.E0[n]*EfieldScl;
@@ -1135,7 +1301,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
                 if(logme) FLAME_LOG(FINE)<<" X EDipole dpy="<<dpy<<"\n";
 
                 Mprob(3, 6) = dpy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "EQuad") {
             if (MpoleLevel >= 2) {
@@ -1148,7 +1314,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
                 Mprob(1, 0) = kfdx;
                 Mprob(3, 2) = kfdy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "HMono") {
             if (MpoleLevel >= 2) {
@@ -1161,7 +1327,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
                 Mprob(1, 0) = kfdx;
                 Mprob(3, 2) = kfdy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "HDipole") {
             if (MpoleLevel >= 1) {
@@ -1172,7 +1338,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
                 if(logme) FLAME_LOG(FINE)<<" X HDipole dpy="<<dpy<<"\n";
 
                 Mprob(3, 6) = dpy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "HQuad") {
             if (MpoleLevel >= 2) {
@@ -1193,7 +1359,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
                 Mprob(1, 0) = kfdx;
                 Mprob(3, 2) = kfdy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "AccGap") {
             //IonFy = IonFy + real.IonZ*V0s[0]*kfac*(TTF_tab[2]*sin(IonFy)
@@ -1207,7 +1373,7 @@ void ElementRFCavity::GenCavMat2(const int cavi, const double dis, const double
 
             Mprob(1, 1) = Accel;
             Mprob(3, 3) = Accel;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
         } else {
             std::ostringstream strm;
             strm << "*** GetCavMat: undef. multipole type " << P.type << "\n";
@@ -1245,9 +1411,9 @@ void ElementRFCavity::GetCavMat(const int cavi, const int cavilabel, const doubl
     beta_s[0]      = sqrt(1e0-1e0/sqr(gamma_s[0]));
     CaviIonK_s[0]  = 2e0*M_PI/(beta_s[0]*CaviLambda);
 
-    size_t n   = CavData.table.size1();
+    size_t n   = model->CavData->table.size1();
     assert(n>0);
-    dis = (CavData.table(n-1,0)-CavData.table(0,0))/2e0;
+    dis = (model->CavData->table(n-1,0)-model->CavData->table(0,0))/2e0;
 
     ElementRFCavity::TransFacts(cavilabel, beta_s[0], CaviIonK_s[0], 1, EfieldScl,
                                 Ecen[0], T[0], Tp[0], S[0], Sp[0], V0[0]);
@@ -1314,10 +1480,10 @@ void ElementRFCavity::GetCavMatGeneric(Particle &real, const double EfieldScl, c
 
     assert(cRm>0);
 
-    for(unsigned n=0; n<lattice.size(); n++) {
-        const RawParams& P = lattice[n];
+    for(unsigned n=0; n<model->lattice.size(); n++) {
+        const RawParams& P = model->lattice[n];
 
-        dis+=lattice[n].length;
+        dis+=model->lattice[n].length;
 
         if (false)
             printf("%9.5f %8s %8s %9.5f %9.5f %9.5f\n",
@@ -1330,16 +1496,15 @@ void ElementRFCavity::GetCavMatGeneric(Particle &real, const double EfieldScl, c
 
             Mprob(0, 1) = P.length;
             Mprob(2, 3) = P.length;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
 
             // Pay attention, original is -
             MprobLon(4, 5) = -2e0*M_PI/CaviLambda*(1e0/cube(beta*gamma)*MeVtoeV/real.IonEs*P.length);
-            Mlon      = prod(MprobLon, Mlon);
+            MatMultLeft(MprobLon, Mlon);
 
         } else if (P.type == "EFocus") {
             V0   = P.E0*EfieldScl;
-            T    = calFitPow(kfac,P.Tfit);
-            S    = calFitPow(kfac,P.Sfit);
+            calFitPow(kfac, P.Tfit, P.Sfit, T, S);
             kfdx = real.IonZ*V0/sqr(beta)/gamma/IonA/AU*(T*cos(IonFy)-S*sin(IonFy))/cRm;
             kfdy = kfdx;
             if(logme) {
@@ -1350,73 +1515,67 @@ void ElementRFCavity::GetCavMatGeneric(Particle &real, const double EfieldScl, c
 
             Mprob(1, 0) = kfdx;
             Mprob(3, 2) = kfdy;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
 
         } else if (P.type == "EDipole") {
             if (MpoleLevel >= 1) {
                 V0  = P.E0*EfieldScl;
-                T = calFitPow(kfac,P.Tfit);
-                S = calFitPow(kfac,P.Sfit);
+                calFitPow(kfac, P.Tfit, P.Sfit, T, S);
                 dpy = real.IonZ*V0/sqr(beta)/gamma/IonA/AU*(T*cos(IonFy)-S*sin(IonFy));
                 if(logme) FLAME_LOG(FINE)<<" X EDipole dpy="<<dpy<<"\n";
 
                 Mprob(3, 6) = dpy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "EQuad") {
             if (MpoleLevel >= 2) {
                 V0   = P.E0*EfieldScl;
-                T = calFitPow(kfac,P.Tfit);
-                S = calFitPow(kfac,P.Sfit);
+                calFitPow(kfac, P.Tfit, P.Sfit, T, S);
                 kfdx =  real.IonZ*V0/sqr(beta)/gamma/IonA/AU*(T*cos(IonFy)-S*sin(IonFy))/cRm;
                 kfdy = -kfdx;
                 if(logme) FLAME_LOG(FINE)<<" X EQuad kfdx="<<kfdx<<"\n";
 
                 Mprob(1, 0) = kfdx;
                 Mprob(3, 2) = kfdy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "HMono") {
             if (MpoleLevel >= 2) {
                 V0   = P.E0*EfieldScl;
-                T = calFitPow(kfac,P.Tfit);
-                S = calFitPow(kfac,P.Sfit);
+                calFitPow(kfac, P.Tfit, P.Sfit, T, S);
                 kfdx = -MU0*C0*real.IonZ*V0/beta/gamma/IonA/AU*(T*cos(IonFy+M_PI/2e0)-S*sin(IonFy+M_PI/2e0))/cRm;
                 kfdy = kfdx;
                 if(logme) FLAME_LOG(FINE)<<" X HMono kfdx="<<kfdx<<"\n";
 
                 Mprob(1, 0) = kfdx;
                 Mprob(3, 2) = kfdy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "HDipole") {
             if (MpoleLevel >= 1) {
                 V0   = P.E0*EfieldScl;
-                T = calFitPow(kfac,P.Tfit);
-                S = calFitPow(kfac,P.Sfit);
+                calFitPow(kfac, P.Tfit, P.Sfit, T, S);
                 dpy = -MU0*C0*real.IonZ*V0/beta/gamma/IonA/AU*(T*cos(IonFy+M_PI/2e0)-S*sin(IonFy+M_PI/2e0));
                 if(logme) FLAME_LOG(FINE)<<" X HDipole dpy="<<dpy<<"\n";
 
                 Mprob(3, 6) = dpy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "HQuad") {
             if (MpoleLevel >= 2) {
                 V0   = P.E0*EfieldScl;
-                T = calFitPow(kfac,P.Tfit);
-                S = calFitPow(kfac,P.Sfit);
+                calFitPow(kfac, P.Tfit, P.Sfit, T, S);
                 kfdx = -MU0*C0*real.IonZ*V0/beta/gamma/IonA/AU*(T*cos(IonFy+M_PI/2e0)-S*sin(IonFy+M_PI/2e0))/cRm;
                 kfdy = -kfdx;
                 if(logme) FLAME_LOG(FINE)<<" X HQuad kfdx="<<kfdx<<"\n";
 
                 Mprob(1, 0) = kfdx;
                 Mprob(3, 2) = kfdy;
-                Mtrans      = prod(Mprob, Mtrans);
+                MatMultLeft(Mprob, Mtrans);
             }
         } else if (P.type == "AccGap") {
             V0   = P.E0*EfieldScl;
-            T = calFitPow(kfac,P.Tfit);
-            S = calFitPow(kfac,P.Sfit);
+            calFitPow(kfac, P.Tfit, P.Sfit, T, S);
             IonW=IonW+real.IonZ*V0*MeVtoeV*T*cos(IonFy)-real.IonZ*V0*MeVtoeV*S*sin(IonFy);
             double gamma_f=IonW/real.IonEs;
             double beta_f=sqrt(1.0-1.0/(gamma_f*gamma_f));
@@ -1426,10 +1585,10 @@ void ElementRFCavity::GetCavMatGeneric(Particle &real, const double EfieldScl, c
 
             Mprob(1, 1) = Accel;
             Mprob(3, 3) = Accel;
-            Mtrans      = prod(Mprob, Mtrans);
+            MatMultLeft(Mprob, Mtrans);
 
             MprobLon(5, 4) = -real.IonZ*V0*T*sin(IonFy)-real.IonZ*V0*S*cos(IonFy);
-            Mlon      = prod(MprobLon, Mlon);
+            MatMultLeft(MprobLon, Mlon);
 
             beta=beta_f;
             gamma=gamma_f;
@@ -1464,6 +1623,85 @@ double ElementRFCavity::calFitPow(double kfac,const std::vector<double>& Tfit) c
     return res;
 }
 
+void ElementRFCavity::calFitPow(double kfac, const std::vector<double>& Tfit, const std::vector<double>& Sfit,
+                                double& T, double& S) const
+{
+    if(Tfit.size()!=10 || Sfit.size()!=10) {
+        T = calFitPow(kfac, Tfit);
+        S = calFitPow(kfac, Sfit);
+        return;
+    }
+
+    // powers of kfac, shared by both fits
+    double p[10];
+    for (int k=0; k<10; k++)
+        p[k]=ipow(kfac,k);
+
+    T=0.0;
+    S=0.0;
+    for (int ii=0; ii<10; ii++)
+    {
+        T=T+Tfit[ii]*p[9-ii];
+        S=S+Sfit[ii]*p[9-ii];
+    }
+}
+
+namespace {
+// exchange the results of the last advance() with a memo entry
+void swap_memo(ElementRFCavity::rfcache_t& C, ElementRFCavity::rfcache_t::memo_t& M)
+{
+    std::swap(C.last_ref_in, M.last_ref_in);
+    std::swap(C.last_ref_out, M.last_ref_out);
+    C.last_real_in.swap(M.last_real_in);
+    C.last_real_out.swap(M.last_real_out);
+    std::swap(C.last_tag_in, M.last_tag_in);
+    std::swap(C.last_tag_out, M.last_tag_out);
+    C.transfer.swap(M.transfer);
+    C.misalign.swap(M.misalign);
+    C.misalign_inv.swap(M.misalign_inv);
+    C.CavTLMLineTab.swap(M.CavTLMLineTab);
+    std::swap(C.phi_ref, M.phi_ref);
+}
+}
+
+bool ElementRFCavity::recall(const state_t& ST, rfcache_t& C) const
+{
+    typedef std::list<rfcache_t::memo_t> memo_t;
+
+    if(skipcache)
+        return false;
+
+    // last_real_out is cleared while results are being computed
+    const bool valid = !C.last_real_in.empty() && C.last_real_out.size()==C.last_real_in.size();
+
+    for(memo_t::iterator it=C.memo.begin(), end=C.memo.end(); it!=end; ++it) {
+        if(it->last_real_in.size()==ST.size()
+                && it->last_real_out.size()==it->last_real_in.size()
+                && it->last_ref_in==ST.ref
+                && std::equal(it->last_real_in.begin(),
+                              it->last_real_in.end(),
+                              ST.real.begin()))
+        {
+            swap_memo(C, *it);
+            if(valid)
+                C.memo.splice(C.memo.begin(), C.memo, it); // current results take the place of the entry found
+            else
+                C.memo.erase(it); // eg. recompute_matrix() threw
+            return true;
+        }
+    }
+
+    if(!valid)
+        return false; // no valid results to save
+
+    if(C.memo.size()<rfcache_t::memo_size)
+        C.memo.push_front(rfcache_t::memo_t());
+    else
+        C.memo.splice(C.memo.begin(), C.memo, --C.memo.end()); // re-use least recently used entry
+    swap_memo(C, C.memo.front());
+    return false;
+}
+
 void ElementRFCavity::GetCavBoost(const numeric_table &CavData, Particle &state, const double IonFy0,
                                   const double EfieldScl, double &IonFy) const
 {
@@ -1510,33 +1748,33 @@ void ElementRFCavity::GetCavBoost(const numeric_table &CavData, Particle &state,
 void ElementRFCavity::PropagateLongRFCav(Particle &ref, double& phi_ref) const
 {
     double multip, EfieldScl, caviFy, IonFy_i, IonFy_o;
-    double fsync = conf().get<double>("syncflag", 1.0);
+    const double fsync = SyncFlag;
 
     multip    = fRF/ref.SampleFreq;
-    EfieldScl = conf().get<double>("scl_fac");         // Electric field scale factor.
+    EfieldScl = SclFac;         // Electric field scale factor.
 
-    if (cavi == 0 && have_EkLim) {
-        if (ref.IonEk/MeVtoeV < EkLim[0] || ref.IonEk/MeVtoeV > EkLim[1])
+    if (cavi == 0 && model->have_EkLim) {
+        if (ref.IonEk/MeVtoeV < model->EkLim[0] || ref.IonEk/MeVtoeV > model->EkLim[1])
             FLAME_LOG(WARN)<< "Warning: RF cavity incident energy (" << ref.IonEk/MeVtoeV
-                << " [MeV]) is out of range (" << EkLim[0] << " ~ " << EkLim[1] << ").\n";
+                << " [MeV]) is out of range (" << model->EkLim[0] << " ~ " << model->EkLim[1] << ").\n";
     }
 
     if (fsync >= 1.0) {
-        if (cavi == 0 && have_RefNrm && have_SynComplex && fsync == 1.0) {
+        if (cavi == 0 && model->have_RefNrm && model->have_SynComplex && fsync == 1.0) {
             // Get driven phase from synchronous phase based on peak position
-            double NormScl = EfieldScl*ref.IonZ/RefNrm;
-            if (have_NrLim) {
-                if (NormScl < NrLim[0] || NormScl > NrLim[1])
+            double NormScl = EfieldScl*ref.IonZ/model->RefNrm;
+            if (model->have_NrLim) {
+                if (NormScl < model->NrLim[0] || NormScl > model->NrLim[1])
                     FLAME_LOG(WARN)<< "Warning: RF cavity normalized scale (" << NormScl
-                        << ") is out of range (" << NrLim[0] << " ~ " << NrLim[1] << ").\n";
+                        << ") is out of range (" << model->NrLim[0] << " ~ " << model->NrLim[1] << ").\n";
             }
-            caviFy = GetCavPhaseComplex(ref, IonFys, NormScl, multip, SynComplex);
+            caviFy = GetCavPhaseComplex(ref, IonFys, NormScl, multip, model->SynComplex);
         } else {
             // Get driven phase from synchronous phase based on sin fit model
-            caviFy = GetCavPhase(cavi, ref, IonFys, multip, SynAccTab);
+            caviFy = GetCavPhase(cavi, ref, IonFys, multip, model->SynAccTab);
         }
     } else {
-        caviFy = conf().get<double>("phi")*M_PI/180e0;
+        caviFy = IonFys;
     }
 
     IonFy_i = multip*ref.phis + caviFy;
@@ -1551,7 +1789,7 @@ void ElementRFCavity::PropagateLongRFCav(Particle &ref, double& phi_ref) const
 
     // For the reference particle, evaluate the change of:
     // kinetic energy, absolute phase, beta, and gamma.
-    GetCavBoost(CavData, ref, IonFy_i, EfieldScl, IonFy_o);
+    GetCavBoost(*model->CavData, ref, IonFy_i, EfieldScl, IonFy_o);
 
     ref.IonEk       = ref.IonW - ref.IonEs;
     ref.recalc();
@@ -1559,9 +1797,9 @@ void ElementRFCavity::PropagateLongRFCav(Particle &ref, double& phi_ref) const
 }
 
 
-void ElementRFCavity::calRFcaviEmitGrowth(const state_t::matrix_t &matIn, Particle &state, const int n, const double betaf, const double gamaf,
+void ElementRFCavity::calRFcaviEmitGrowth(const rfcache_t &C, const state_t::matrix_t &matIn, Particle &state, const int n, const double betaf, const double gamaf,
                                           const double aveX2i, const double cenX, const double aveY2i, const double cenY,
-                                          state_t::matrix_t &matOut)
+                                          state_t::matrix_t &matOut) const
 {
     // Evaluate emittance growth.
     int       k;
@@ -1573,9 +1811,9 @@ void ElementRFCavity::calRFcaviEmitGrowth(const state_t::matrix_t &matIn, Partic
     ionLamda = C0/fRF*MtoMM;
 
     // safe to look at last_real_out[] here as we are called (from advance() ) after it is updated
-    const double accIonW   =  last_real_out[n].IonW -last_real_in[n].IonW,
-                 ave_beta  = (last_real_out[n].beta +last_real_in[n].beta)/2.0,
-                 ave_gamma = (last_real_out[n].gamma+last_real_in[n].gamma)/2.0;
+    const double accIonW   =  C.last_real_out[n].IonW -C.last_real_in[n].IonW,
+                 ave_beta  = (C.last_real_out[n].beta +C.last_real_in[n].beta)/2.0,
+                 ave_gamma = (C.last_real_out[n].gamma+C.last_real_in[n].gamma)/2.0;
 
     E0TL     = accIonW/cos(IonFys)/state.IonZ;
 
@@ -1622,7 +1860,7 @@ void ElementRFCavity::calRFcaviEmitGrowth(const state_t::matrix_t &matIn, Partic
 }
 
 
-void ElementRFCavity::InitRFCav(Particle &real, state_t::matrix_t &M, CavTLMLineType &linetab)
+void ElementRFCavity::InitRFCav(Particle &real, const double phi_ref, state_t::matrix_t &M, CavTLMLineType &linetab) const
 {
     int         cavilabel;
     double      Rm, multip, IonFy_i, Ek_i, EfieldScl, IonFy_o;
@@ -1659,8 +1897,8 @@ void ElementRFCavity::InitRFCav(Particle &real, state_t::matrix_t &M, CavTLMLine
     Ek_i      = real.IonEk;
     real.IonW = real.IonEk + real.IonEs;
 
-    EfieldScl = conf().get<double>("scl_fac");         // Electric field scale factor.
-    ElementRFCavity::GetCavBoost(CavData, real, IonFy_i, EfieldScl, IonFy_o); // updates IonW
+    EfieldScl = SclFac;         // Electric field scale factor.
+    ElementRFCavity::GetCavBoost(*model->CavData, real, IonFy_i, EfieldScl, IonFy_o); // updates IonW
 
     real.IonEk       = real.IonW - real.IonEs;
     real.recalc();
@@ -3,6 +3,9 @@
 #include <boost/test/unit_test.hpp>
 
 #include <math.h>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
 
 #include "flame/core/config.h"
 
@@ -19,6 +22,26 @@ BOOST_AUTO_TEST_CASE(config_getset)
     BOOST_CHECK_CLOSE(C.get<double>("world", 5.2), 5.2, 0.1);
 }
 
+BOOST_AUTO_TEST_CASE(config_find)
+{
+    Config C;
+
+    C.set<double>("hello", 4.2);
+    C.set<std::string>("world", "test");
+
+    BOOST_REQUIRE(C.findAny("hello")!=NULL);
+    BOOST_CHECK_EQUAL(std::get<double>(*C.findAny("hello")), 4.2);
+    BOOST_CHECK(C.findAny("nothere")==NULL);
+
+    // wrong type is treated as missing
+    BOOST_CHECK_EQUAL(C.get<double>("world", 5.2), 5.2);
+    double val = 1.0;
+    BOOST_CHECK(!C.tryGet<double>("world", val));
+    BOOST_CHECK_EQUAL(val, 1.0);
+    BOOST_CHECK(C.tryGet<double>("hello", val));
+    BOOST_CHECK_EQUAL(val, 4.2);
+}
+
 static const char config_print_stmt_input[] =
 "X = 14;\n"
 "print(X);\n"
@@ -37,3 +60,181 @@ BOOST_AUTO_TEST_CASE(config_print_stmt)
 
     BOOST_CHECK_EQUAL(strm.str(), "On line 2 : 14\n" "On line 4 : \"test\"\n");
 }
+
+BOOST_AUTO_TEST_CASE(config_parse_large)
+{
+    // more statements than the parser stack depth
+    std::ostringstream strm;
+    for(unsigned i=0; i<20000; i++)
+        strm<<"X"<<i<<" = "<<i<<";\n";
+    strm<<"foo : bar, x=[1, 2, 3];\n"
+          "baz : bar, x=[4];\n"
+          "line : LINE = (foo, baz, foo);\n";
+    const std::string input(strm.str());
+
+    GLPSParser parse;
+    std::unique_ptr<Config> conf(parse.parse_byte(input.c_str(), input.size()));
+
+    BOOST_CHECK_EQUAL(conf->get<double>("X19999"), 19999.0);
+
+    const Config::vector_t& elems = conf->get<Config::vector_t>("elements");
+    BOOST_REQUIRE_EQUAL(elems.size(), 3u);
+    BOOST_CHECK_EQUAL(elems[0].get<std::string>("name"), "foo");
+    BOOST_CHECK_EQUAL(elems[1].get<std::string>("name"), "baz");
+    BOOST_CHECK_EQUAL(elems[2].get<std::string>("name"), "foo");
+    BOOST_CHECK_EQUAL(elems[2].get<std::vector<double> >("x").size(), 3u);
+
+    // repeated elements share storage until modified
+    Config C(elems[2]);
+    C.set<double>("y", 1.0);
+    BOOST_CHECK(elems[0].findAny("y")==NULL);
+    BOOST_CHECK_EQUAL(C.get<double>("X5"), 5.0);
+}
+
+BOOST_AUTO_TEST_CASE(config_parse_vector)
+{
+    GLPSParser parse;
+    std::unique_ptr<Config> conf;
+
+    static const char input[] =
+    "A = [1, -2.5e3,\n"
+    "     3., 007];\n"
+    "B = [4];\n"
+    "C = [];\n"
+    "D = [1, -(2), 3*2];\n"
+    "foo : drift, L=1;\n"
+    "line : LINE = (foo);\n";
+    conf.reset(parse.parse_byte(input, sizeof(input)-1));
+
+    const std::vector<double>& A = conf->get<std::vector<double> >("A");
+    BOOST_REQUIRE_EQUAL(A.size(), 4u);
+    BOOST_CHECK_EQUAL(A[0], 1.0);
+    BOOST_CHECK_EQUAL(A[1], -2500.0);
+    BOOST_CHECK_EQUAL(A[2], 3.0);
+    BOOST_CHECK_EQUAL(A[3], 7.0);
+    BOOST_CHECK_EQUAL(conf->get<std::vector<double> >("B").size(), 1u);
+    BOOST_CHECK_EQUAL(conf->get<std::vector<double> >("C").size(), 0u);
+    const std::vector<double>& D = conf->get<std::vector<double> >("D");
+    BOOST_REQUIRE_EQUAL(D.size(), 3u);
+    BOOST_CHECK_EQUAL(D[1], -2.0);
+    BOOST_CHECK_EQUAL(D[2], 6.0);
+
+    // line numbers continue after a multi-line literal
+    static const char input2[] =
+    "A = [1,\n"
+    "     2];\n"
+    "B = [1, 1e400];\n";
+    try {
+        conf.reset(parse.parse_byte(input2, sizeof(input2)-1));
+        BOOST_ERROR("expected exception");
+    } catch(std::runtime_error& e) {
+        BOOST_CHECK_EQUAL(std::string(e.what()), "On line 3: Invalid numeric constant '1e400'");
+    }
+}
+
+static const char config_binary_input[] =
+"sim_type = \"Vector\";\n"
+"X = [1, 2.5, -3e-9];\n"
+"S = \"hello world\";\n"
+"foo : drift, L=1, curve=[4, 5];\n"
+"bar : marker;\n"
+"line : LINE = (foo, bar, foo);\n";
+
+BOOST_AUTO_TEST_CASE(config_binary_roundtrip)
+{
+    GLPSParser parse;
+    parse.setCacheDir("");
+    std::unique_ptr<Config> conf(parse.parse_byte(config_binary_input, sizeof(config_binary_input)-1));
+
+    std::ostringstream bin;
+    GLPSWriteBinary(bin, *conf);
+    const std::string raw(bin.str());
+
+    std::unique_ptr<Config> copy(GLPSReadBinary(raw.c_str(), raw.size()));
+
+    std::ostringstream expect, actual;
+    GLPSPrint(expect, *conf);
+    GLPSPrint(actual, *copy);
+    BOOST_CHECK_EQUAL(actual.str(), expect.str());
+
+    BOOST_CHECK_EQUAL(copy->get<std::string>("S"), "hello world");
+    BOOST_CHECK_EQUAL(copy->get<std::vector<double> >("X")[2], -3e-9);
+
+    const Config::vector_t& elems = copy->get<Config::vector_t>("elements");
+    BOOST_REQUIRE_EQUAL(elems.size(), 3u);
+    BOOST_CHECK_EQUAL(elems[2].get<std::vector<double> >("curve")[1], 5.0);
+    // enclosing scope and repeated elements remain shared
+    BOOST_CHECK_EQUAL(elems[1].get<std::string>("S"), "hello world");
+    BOOST_CHECK(elems[0].findAny("curve")==elems[2].findAny("curve"));
+
+    BOOST_CHECK_THROW(GLPSReadBinary(raw.c_str(), raw.size()-8), std::runtime_error);
+    BOOST_CHECK_THROW(GLPSReadBinary(raw.c_str()+1, raw.size()-1), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(config_parse_cache)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path()/boost::filesystem::unique_path());
+
+    std::string expect;
+    {
+        GLPSParser parse;
+        parse.setCacheDir(dir.string());
+        std::unique_ptr<Config> conf(parse.parse_byte(config_binary_input, sizeof(config_binary_input)-1));
+        std::ostringstream strm;
+        GLPSPrint(strm, *conf);
+        expect = strm.str();
+    }
+
+    BOOST_REQUIRE(boost::filesystem::is_directory(dir));
+    BOOST_CHECK_EQUAL(std::distance(boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()), 1);
+
+    {
+        GLPSParser parse;
+        parse.setCacheDir(dir.string());
+        std::unique_ptr<Config> conf(parse.parse_byte(config_binary_input, sizeof(config_binary_input)-1));
+        std::ostringstream strm;
+        GLPSPrint(strm, *conf);
+        BOOST_CHECK_EQUAL(strm.str(), expect);
+    }
+    {
+        // a different variable gives a different result
+        GLPSParser parse;
+        parse.setCacheDir(dir.string());
+        parse.setVar("Y", 4.0);
+        std::unique_ptr<Config> conf(parse.parse_byte(config_binary_input, sizeof(config_binary_input)-1));
+        BOOST_CHECK_EQUAL(conf->get<double>("Y"), 4.0);
+    }
+    BOOST_CHECK_EQUAL(std::distance(boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()), 2);
+
+    {
+        // print() is not cached
+        std::ostringstream out;
+        GLPSParser parse;
+        parse.setCacheDir(dir.string());
+        parse.setPrinter(&out);
+        std::unique_ptr<Config> conf(parse.parse_byte(config_print_stmt_input, sizeof(config_print_stmt_input)-1));
+    }
+    BOOST_CHECK_EQUAL(std::distance(boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()), 2);
+
+    {
+        // a cached dir() is checked again
+        boost::filesystem::path data(boost::filesystem::temp_directory_path()/boost::filesystem::unique_path());
+        boost::filesystem::create_directory(data);
+        const std::string input("D = dir(\""+data.string()+"\");\n"
+                                "foo : drift, L=1;\n"
+                                "line : LINE = (foo);\n");
+
+        GLPSParser parse;
+        parse.setCacheDir(dir.string());
+        for(unsigned i=0; i<2; i++) {
+            std::unique_ptr<Config> conf(parse.parse_byte(input.c_str(), input.size()));
+            BOOST_CHECK_EQUAL(conf->get<std::string>("D"), boost::filesystem::canonical(data).string());
+        }
+        BOOST_CHECK_EQUAL(std::distance(boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()), 3);
+
+        boost::filesystem::remove(data);
+        BOOST_CHECK_THROW(parse.parse_byte(input.c_str(), input.size()), std::runtime_error);
+    }
+
+    boost::filesystem::remove_all(dir);
+}
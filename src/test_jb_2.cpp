@@ -46,6 +46,7 @@ void PrtMat(const value_mat &M)
 
 void PrtState(const state_t& ST)
 {
+    ST.update_rms();
     MomentState::vector_t CenofChg, BeamRMS;
 
     if (true)
@@ -77,6 +78,7 @@ void prt_initial_cond(Machine &sim,
 static
 void PrtOut(std::ofstream &outf1, std::ofstream &outf2, std::ofstream &outf3, const state_t& ST)
 {
+    ST.update_rms();
     outf1 << std::scientific << std::setprecision(14) << std::setw(22) << ST.pos;
     for (size_t j = 0; j < ST.size(); j++)
         for (int k = 0; k < 6; k++)
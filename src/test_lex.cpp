@@ -41,6 +41,13 @@ int main(int argc, char *argv[])
         case NUM:
             printf("Number: %g\n", lval.real);
             break;
+        case NUMVEC:
+            printf("Vector:");
+            for(size_t i=lval.vector->value.size(); i; i--)
+                printf(" %g", lval.vector->value[i-1]);
+            printf("\n");
+            delete lval.vector;
+            break;
         case STR:
             printf("String: \"%s\"\n", lval.string->str.c_str());
             delete lval.string;
@@ -0,0 +1,124 @@
+#define BOOST_TEST_MODULE moment_sup
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+#include <string.h>
+
+#include "flame/moment.h"
+#include "flame/moment_sup.h"
+
+namespace {
+
+typedef MomentElementBase::value_t value_t;
+typedef MomentElementBase::sparsity_t sparsity_t;
+
+enum {N=MomentState::maxsize};
+
+value_t identity()
+{
+    value_t M = boost::numeric::ublas::identity_matrix<double>(N);
+    return M;
+}
+
+// fill the blocks of a Block2 matrix with non-trivial values
+value_t block2()
+{
+    value_t M(identity());
+    for(unsigned i=0; i<N-1; i+=2) {
+        M(i  ,i) = cos(0.3*i+0.1); M(i  ,i+1) =  sin(0.3*i+0.1);
+        M(i+1,i) = -0.7*M(i,i+1);  M(i+1,i+1) = 1.1*M(i,i);
+    }
+    return M;
+}
+
+value_t block4()
+{
+    value_t M(block2());
+    M(0,2) = 0.125; M(1,3) = -0.25;
+    M(2,1) = 1e-3;  M(3,0) = -3e-3;
+    return M;
+}
+
+// not structurally zero anywhere
+value_t dense_values(double scale)
+{
+    value_t M(N, N);
+    for(unsigned i=0; i<N; i++)
+        for(unsigned j=0; j<N; j++)
+            M(i,j) = scale*sin(1.0+i*N+j);
+    return M;
+}
+
+void check_kernels(const value_t& M)
+{
+    const sparsity_t S = MatSparsity(M);
+
+    MomentState::vector_t xd(N), xs(N);
+    for(unsigned i=0; i<N; i++)
+        xd[i] = xs[i] = cos(2.0+i)*(i%3==0 ? -1.0 : 1.0);
+
+    MatVecMult(M, xd);
+    MatVecMult(M, xs, S);
+    BOOST_CHECK(memcmp(&xd.data()[0], &xs.data()[0], N*sizeof(double))==0);
+
+    value_t Sd(dense_values(1e-3)), Ss, scratch;
+    Sd = Sd + boost::numeric::ublas::trans(Sd); // symmetric, like a moment matrix
+    Ss = Sd;
+
+    MatSandwich(M, Sd, scratch);
+    MatSandwich(M, Ss, scratch, S);
+    BOOST_CHECK(MatEqual(Sd, Ss));
+    BOOST_CHECK(memcmp(&Sd.data()[0], &Ss.data()[0], N*N*sizeof(double))==0);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(sparsity_classify)
+{
+    BOOST_CHECK_EQUAL(MatSparsity(identity()), MomentElementBase::Identity);
+    BOOST_CHECK_EQUAL(MatSparsity(block2()), MomentElementBase::Block2);
+    BOOST_CHECK_EQUAL(MatSparsity(block4()), MomentElementBase::Block4);
+
+    {
+        // a column 6 (orbit kick) term
+        value_t M(block2());
+        M(0,6) = 1e-3;
+        BOOST_CHECK_EQUAL(MatSparsity(M), MomentElementBase::Dense);
+    }
+    {
+        // coupling between transverse and longitudinal
+        value_t M(block4());
+        M(1,4) = 0.5;
+        BOOST_CHECK_EQUAL(MatSparsity(M), MomentElementBase::Dense);
+    }
+    {
+        value_t M(block2());
+        M(6,6) = 2.0;
+        BOOST_CHECK_EQUAL(MatSparsity(M), MomentElementBase::Dense);
+    }
+    BOOST_CHECK_EQUAL(MatSparsity(value_t(3,3,0.0)), MomentElementBase::Dense);
+}
+
+BOOST_AUTO_TEST_CASE(sparsity_kernels_exact)
+{
+    check_kernels(identity());
+    check_kernels(block2());
+    check_kernels(block4());
+    {
+        value_t M(block2());
+        M(0,6) = 1e-3;
+        check_kernels(M);
+    }
+    {
+        value_t M(block4());
+        M(1,4) = 0.5;
+        check_kernels(M);
+    }
+    {
+        value_t M(block2());
+        M(6,6) = 2.0;
+        check_kernels(M);
+    }
+    check_kernels(dense_values(1.0));
+}
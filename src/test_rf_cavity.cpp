@@ -0,0 +1,81 @@
+#define BOOST_TEST_MODULE rf_cavity
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <memory>
+#include <stdexcept>
+
+#include "flame/core/base.h"
+#include "flame/core/config.h"
+#include "flame/moment.h"
+#include "flame/moment_sup.h"
+#include "flame/rf_cavity.h"
+#include "flame/register.h"
+
+namespace {
+
+static const char lattice[] =
+"sim_type = \"MomentMatrix\";\n"
+"MpoleLevel = \"2\";\n"
+"EmitGrowth = \"1\";\n"
+"Eng_Data_Dir = \"" FLAME_TEST_DATA_DIR "\";\n"
+"cav: rfcavity, cavtype = \"0.041QWR\", L = 0.24,\n"
+"  f = 80.5e6, phi = -35.0, scl_fac = 0.64, aper = 0.017;\n"
+"line: LINE = (cav);\n";
+
+Config initial(double IonEk)
+{
+    Config C;
+    C.set<double>("IonEs", 931.49432e6);
+    C.set<double>("IonEk", IonEk);
+    C.set<std::vector<double> >("IonChargeStates", std::vector<double>(1, 33.0/238.0));
+    C.set<std::vector<double> >("NCharge", std::vector<double>(1, 10111.0));
+    C.set<std::vector<double> >("moment00", std::vector<double>(MomentState::maxsize, 0.0));
+    std::vector<double> S(MomentState::maxsize*MomentState::maxsize, 0.0);
+    for(size_t i=0; i<6; i++)
+        S[i*MomentState::maxsize+i] = 1e-3*(i+1);
+    C.set<std::vector<double> >("initial0", S);
+    return C;
+}
+
+MomentState* run(const Machine& M, double IonEk)
+{
+    std::unique_ptr<StateBase> S(M.allocState(initial(IonEk)));
+    M.propagate(S.get());
+    return static_cast<MomentState*>(S.release());
+}
+
+} // namespace
+
+// An input state for which recompute_matrix() failed must not be recalled later.
+BOOST_AUTO_TEST_CASE(rfcav_recall_after_error)
+{
+    registerMoment();
+
+    GLPSParser parse;
+    std::unique_ptr<Config> conf(parse.parse_byte(lattice, sizeof(lattice)-1));
+    Machine M(*conf);
+    conf->set<double>("skipcache", 1.0);
+    Machine R(*conf);
+
+    ElementRFCavity* cav = static_cast<ElementRFCavity*>(M[0]);
+    const int cavi = cav->cavi;
+
+    std::unique_ptr<MomentState> S(run(M, 0.5e6));
+
+    cav->cavi = -1; // GetCavPhase() throws
+    BOOST_CHECK_THROW(run(M, 0.6e6), std::runtime_error);
+    cav->cavi = cavi;
+
+    S.reset(run(M, 0.5e6)); // found in memo
+    S.reset(run(M, 0.6e6));
+
+    std::unique_ptr<MomentState> E(run(R, 0.6e6));
+
+    BOOST_CHECK_CLOSE(S->ref.IonEk, E->ref.IonEk, 1e-10);
+    BOOST_CHECK_CLOSE(S->ref.phis, E->ref.phis, 1e-10);
+    BOOST_CHECK_CLOSE(S->real[0].IonEk, E->real[0].IonEk, 1e-10);
+    for(size_t i=0; i<MomentState::maxsize; i++)
+        for(size_t j=0; j<MomentState::maxsize; j++)
+            BOOST_CHECK_SMALL(S->moment1[0](i,j) - E->moment1[0](i,j), 1e-12);
+}
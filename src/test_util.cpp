@@ -2,7 +2,11 @@
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 
+#include <fstream>
+#include <sstream>
+
 #include <boost/numeric/ublas/io.hpp>
+#include <boost/filesystem.hpp>
 
 #include "flame/core/util.h"
 
@@ -98,6 +102,167 @@ BOOST_AUTO_TEST_CASE(parse_table4)
     BOOST_CHECK_THROW(tbl.read(strm), std::runtime_error);
 }
 
+static const char table5[] = {
+    "%A  B\r\n"
+    " +12 -1.5e2\r\n"
+    "\r\n"
+    "14\t.5 \r\n"
+};
+
+BOOST_AUTO_TEST_CASE(parse_table5)
+{
+    std::istringstream strm(table5);
+
+    numeric_table tbl;
+    tbl.read(strm);
+
+    BOOST_CHECK_EQUAL(tbl.colnames.size(), 2);
+    BOOST_CHECK_EQUAL(tbl.colnames["B"], 1);
+
+    std::ostringstream out;
+    out<<tbl.table;
+
+    BOOST_CHECK_EQUAL(out.str(), "[2,2]((12,-150),(14,0.5))");
+}
+
+BOOST_AUTO_TEST_CASE(binary_table)
+{
+    numeric_table tbl;
+    tbl.read(table1, sizeof(table1)-1);
+
+    std::ostringstream strm;
+    tbl.write_binary(strm);
+    const std::string raw(strm.str());
+
+    BOOST_CHECK(numeric_table::is_binary(raw.c_str(), raw.size()));
+    BOOST_CHECK(!numeric_table::is_binary(table1, sizeof(table1)-1));
+
+    numeric_table copy;
+    copy.read_binary(raw.c_str(), raw.size());
+
+    BOOST_CHECK(copy.colnames==tbl.colnames);
+
+    std::ostringstream out;
+    out<<copy.table;
+    BOOST_CHECK_EQUAL(out.str(), "[3,2]((12,13),(14,15),(16,17))");
+
+    BOOST_CHECK_THROW(copy.read_binary(raw.c_str(), raw.size()-8), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(table_cache)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path()/boost::filesystem::unique_path());
+    boost::filesystem::create_directories(dir/"tables");
+    const std::string fname((dir/"table1.txt").string());
+    {
+        std::ofstream strm(fname.c_str());
+        strm<<table1;
+    }
+
+    {
+        numeric_table_cache cache;
+        cache.setCacheDir((dir/"tables").string());
+        numeric_table_cache::table_pointer tbl(cache.fetch(fname));
+        BOOST_CHECK_EQUAL(tbl->table(2, 1), 17.0);
+        // in memory until modified
+        BOOST_CHECK(cache.fetch(fname)==tbl);
+    }
+
+    BOOST_REQUIRE_EQUAL(std::distance(boost::filesystem::directory_iterator(dir/"tables"), boost::filesystem::directory_iterator()), 1);
+    const std::string cname(boost::filesystem::directory_iterator(dir/"tables")->path().string());
+
+    {
+        // binary files are loaded directly
+        numeric_table_cache cache;
+        cache.setCacheDir("");
+        numeric_table_cache::table_pointer tbl(cache.fetch(cname));
+        BOOST_CHECK_EQUAL(tbl->table(2, 1), 17.0);
+        BOOST_CHECK_EQUAL(tbl->colnames.size(), 2);
+    }
+
+    boost::filesystem::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(test_data_file_cache)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path()/boost::filesystem::unique_path());
+    boost::filesystem::create_directories(dir);
+    const std::string A((dir/"A").string()), B((dir/"B").string());
+    {
+        std::ofstream strm(A.c_str());
+        strm<<"1";
+    }
+    {
+        std::ofstream strm(B.c_str());
+        strm<<"2";
+    }
+
+    data_file_cache cache;
+    cache.set_capacity(2);
+    unsigned nload = 0;
+
+    struct loader {
+        unsigned& nload;
+        const std::string fname;
+        std::shared_ptr<int> operator()() const {
+            nload++;
+            std::ifstream strm(fname.c_str());
+            std::shared_ptr<int> ret(new int(0));
+            strm>>*ret;
+            return ret;
+        }
+    };
+    loader LA = {nload, A}, LB = {nload, B};
+
+    std::shared_ptr<const int> a(cache.fetch<int>("int", data_file_cache::files_t(1, A), LA));
+    BOOST_CHECK_EQUAL(*a, 1);
+    BOOST_CHECK(cache.fetch<int>("int", data_file_cache::files_t(1, A), LA)==a);
+    BOOST_CHECK_EQUAL(nload, 1u);
+
+    data_file_cache::stats_t S(cache.stats());
+    BOOST_CHECK_EQUAL(S.size, 1u);
+    BOOST_CHECK_EQUAL(S.hits, 1u);
+    BOOST_CHECK_EQUAL(S.misses, 1u);
+
+    // another kind is another entry
+    cache.fetch<int>("other", data_file_cache::files_t(1, A), LA);
+    BOOST_CHECK_EQUAL(nload, 2u);
+
+    // least recently used, "other", is evicted
+    cache.fetch<int>("int", data_file_cache::files_t(1, A), LA);
+    cache.fetch<int>("int", data_file_cache::files_t(1, B), LB);
+    BOOST_CHECK_EQUAL(nload, 3u);
+    S = cache.stats();
+    BOOST_CHECK_EQUAL(S.size, 2u);
+    BOOST_CHECK_EQUAL(S.evictions, 1u);
+    cache.fetch<int>("int", data_file_cache::files_t(1, A), LA);
+    BOOST_CHECK_EQUAL(nload, 3u);
+    cache.fetch<int>("other", data_file_cache::files_t(1, A), LA);
+    BOOST_CHECK_EQUAL(nload, 4u);
+    // evicted entries remain valid
+    BOOST_CHECK_EQUAL(*a, 1);
+
+    // drops both kinds
+    cache.invalidate(A);
+    BOOST_CHECK_EQUAL(cache.stats().size, 0u);
+    cache.fetch<int>("int", data_file_cache::files_t(1, A), LA);
+    BOOST_CHECK_EQUAL(nload, 5u);
+
+    // modified files are loaded again
+    {
+        std::ofstream strm(A.c_str());
+        strm<<"3";
+    }
+    boost::filesystem::last_write_time(A, boost::filesystem::last_write_time(A)+10);
+    BOOST_CHECK_EQUAL(*cache.fetch<int>("int", data_file_cache::files_t(1, A), LA), 3);
+    BOOST_CHECK_EQUAL(nload, 6u);
+
+    cache.clear("int");
+    BOOST_CHECK_EQUAL(cache.stats().size, 0u);
+
+    boost::filesystem::remove_all(dir);
+}
+
 BOOST_AUTO_TEST_CASE(test_ndindex_iterate)
 {
     size_t limits[2] = {2,3};
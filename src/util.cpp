@@ -1,11 +1,19 @@
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <iterator>
+#include <sstream>
 
 #include <ctime>
 
 #include <boost/numeric/ublas/vector.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/filesystem.hpp>
 // #define BOOST_FILESYSTEM_DYN_LINK
 // #include <boost/filesystem.hpp>
 #include "flame/core/util.h"
@@ -24,148 +32,453 @@ void numeric_table::readvec(std::vector<double> vec, int numcol)
 
 void numeric_table::read(std::istream &strm)
 {
-    typedef boost::numeric::ublas::vector<double> vector_t;
+    std::string raw((std::istreambuf_iterator<char>(strm)), std::istreambuf_iterator<char>());
+    if(strm.bad())
+        throw std::runtime_error("Error reading table");
+    read(raw.c_str(), raw.size());
+}
 
-    std::string rawline;
+namespace {
+bool is_blank(char c) { return c==' ' || c=='\t' || c=='\r'; }
+}
 
+void numeric_table::read(const char *buf, size_t len)
+{
+    // values of all rows, in row-major order
     std::vector<double> values;
+    size_t ncols = 0, nrows = 0;
 
-    std::vector<vector_t> table;
-
+    const char * const end = buf+len;
     unsigned line = 0;
-    while(std::getline(strm, rawline)) {
+    for(const char *next; buf!=end; buf = next) {
         line++;
-        values.clear();
-
-        size_t cpos = rawline.find_first_not_of(" \t");
-        if(cpos==rawline.npos)
-            continue; // skip blank and comment lines
-
-        cpos = rawline.find_last_not_of("\r\n");
-        if(cpos!=rawline.npos)
-            rawline = rawline.substr(0, cpos+1);
-
-        if(rawline[0]=='%') {
+        const char *eol = std::find(buf, end, '\n');
+        next = eol==end ? end : eol+1;
+
+        while(eol!=buf && is_blank(eol[-1]))
+            eol--;
+        const char *pos = buf;
+        while(pos!=eol && is_blank(*pos))
+            pos++;
+        if(pos==eol)
+            continue; // skip blank lines
+
+        if(*pos=='%') {
             // headers
-            size_t P = rawline.find_first_not_of(" \t", 1);
-
             colnames_t cols;
 
             unsigned col=0;
-            while(P!=rawline.npos) {
-                size_t E = rawline.find_first_of(" \t", P);
-
-                const std::string& ent = rawline.substr(P, E==rawline.npos ? E : E-P);
-                cols[ent] = col++;
-
-                P = rawline.find_first_not_of(" \t", E);
+            for(pos++; pos!=eol; ) {
+                while(pos!=eol && is_blank(*pos))
+                    pos++;
+                const char *E = std::find_if(pos, eol, is_blank);
+                if(E!=pos)
+                    cols[std::string(pos, E)] = col++;
+                pos = E;
             }
 
             colnames.swap(cols);
 
         } else {
             // data
+            size_t N = 0;
 
-            std::istringstream lstrm(rawline);
+            while(pos!=eol) {
+                const char *E = std::find_if(pos, eol, is_blank);
+                const char *first = pos;
+                if(*first=='+' && E-first>1 && first[1]!='-')
+                    first++; // from_chars does not accept a leading '+'
 
-            while(lstrm.good()) {
                 double val;
-                lstrm>>val;
-                if(!lstrm.fail())
-                    values.push_back(val);
+                std::from_chars_result R = std::from_chars(first, E, val);
+                if(R.ec!=std::errc() || R.ptr!=E)
+                    throw std::runtime_error(SB()<<"Error parsing data line "<<line<<" '"<<std::string(buf, eol)<<"'");
+                values.push_back(val);
+                N++;
+
+                pos = E;
+                while(pos!=eol && is_blank(*pos))
+                    pos++;
             }
 
-            if(!lstrm.eof() && lstrm.fail())
-                throw std::runtime_error(SB()<<"Error parsing data line "<<line<<" '"<<rawline<<"'");
-
-            if(!table.empty() && table.back().size()!=values.size())
+            if(nrows && N!=ncols)
                 throw std::runtime_error(SB()<<"Line "<<line<<" w/ different # of elements");
+            ncols = N;
+            nrows++;
+        }
+    }
 
-            table.push_back(vector_t(values.size()));
+    value_t result(nrows, ncols);
+    std::copy(values.begin(), values.end(), result.data().begin());
+    this->table.swap(result);
+}
 
-            std::copy(values.begin(),
-                      values.end(),
-                      table.back().begin());
-        }
+namespace {
+const char table_magic[8] = {'F','L','A','M','E','T','B','L'};
+const uint32_t table_version = 1;
+
+// Increment when a change to numeric_table::read() changes the result for the same
+// input.  Existing cache files of text tables are then not re-used.
+const uint32_t cache_version = 1;
+const uint32_t table_order = 0x01020304;
+
+template<typename T>
+void put(std::string& out, T v)
+{
+    out.append((const char*)&v, sizeof(v));
+}
+
+void pad(std::string& out)
+{
+    out.resize((out.size()+7u)&~size_t(7u), '\0');
+}
+
+struct table_reader {
+    const char *buf;
+    size_t len, pos;
+
+    void need(size_t n) const
+    {
+        if(n>len-pos)
+            throw std::runtime_error("Binary table truncated");
     }
 
-    if(!strm.eof() && strm.fail())
-        throw std::runtime_error(SB()<<"Error parsing line "<<line<<" '"<<rawline<<"'");
-    else if(table.empty()) {
-        this->table.clear();
-    } else {
-        value_t result(table.size(), table.front().size());
-
-        for(size_t r=0; r<result.size1(); r++) {
-            const vector_t& R=table[r];
-            for(size_t c=0; c<result.size2(); c++) {
-                std::copy(R.begin(),
-                          R.end(),
-                          result.find2(2, r,0));
-            }
-        }
+    template<typename T>
+    T get()
+    {
+        T ret;
+        need(sizeof(T));
+        memcpy(&ret, buf+pos, sizeof(T));
+        pos += sizeof(T);
+        return ret;
+    }
 
-        this->table.swap(result);
+    void skip_pad()
+    {
+        size_t next = (pos+7u)&~size_t(7u);
+        need(next-pos);
+        pos = next;
     }
+};
 }
 
-struct numeric_table_cache::Pvt {
-    boost::mutex lock;
+void numeric_table::write_binary(std::ostream& strm) const
+{
+    std::string out;
+
+    out.append(table_magic, sizeof(table_magic));
+    put(out, table_version);
+    put(out, table_order);
+    put<uint64_t>(out, table.size1());
+    put<uint64_t>(out, table.size2());
+
+    put<uint64_t>(out, colnames.size());
+    for(colnames_t::const_iterator it=colnames.begin(), end=colnames.end(); it!=end; ++it)
+    {
+        put<uint64_t>(out, it->second);
+        put<uint64_t>(out, it->first.size());
+        out.append(it->first);
+        pad(out);
+    }
+
+    if(!table.data().empty())
+        out.append((const char*)&table.data()[0], table.data().size()*sizeof(double));
+
+    strm.write(out.c_str(), out.size());
+}
+
+bool numeric_table::is_binary(const char *buf, size_t len)
+{
+    return len>=sizeof(table_magic) && memcmp(buf, table_magic, sizeof(table_magic))==0;
+}
+
+void numeric_table::read_binary(const char *buf, size_t len)
+{
+    if(!is_binary(buf, len))
+        throw std::runtime_error("Not a binary table");
+
+    table_reader R = {buf, len, sizeof(table_magic)};
+
+    uint32_t version = R.get<uint32_t>(),
+             order = R.get<uint32_t>();
+    if(version!=table_version || order!=table_order)
+        throw std::runtime_error(SB()<<"Binary table has unsupported version "<<version<<" or byte order");
+
+    uint64_t nrows = R.get<uint64_t>(),
+             ncols = R.get<uint64_t>(),
+             nnames = R.get<uint64_t>();
+
+    colnames_t cols;
+    for(uint64_t i=0; i<nnames; i++) {
+        uint64_t col = R.get<uint64_t>(),
+                 nlen = R.get<uint64_t>();
+        R.need(nlen);
+        cols[std::string(buf+R.pos, nlen)] = col;
+        R.pos += nlen;
+        R.skip_pad();
+    }
+
+    if(ncols && nrows>(len-R.pos)/sizeof(double)/ncols)
+        throw std::runtime_error("Binary table truncated");
+    if(R.pos+nrows*ncols*sizeof(double)!=len)
+        throw std::runtime_error("Binary table has trailing bytes");
+
+    value_t result(nrows, ncols);
+    if(!result.data().empty())
+        memcpy(&result.data()[0], buf+R.pos, result.data().size()*sizeof(double));
 
-    struct Value {
-        std::filesystem::file_time_type lastmod;
-        typedef std::shared_ptr<numeric_table> table_pointer;
-        table_pointer table;
+    colnames.swap(cols);
+    this->table.swap(result);
+}
+
+struct data_file_cache::Pvt {
+    struct Entry {
+        typedef std::vector<std::pair<std::string, std::filesystem::file_time_type> > files_t;
+        files_t files;
+        value_pointer value;
+        mutable std::atomic<uint64_t> last_use;
     };
+    typedef std::map<std::string, std::shared_ptr<const Entry> > entries_t;
+
+    // Readers atomic_load() a snapshot.  Writers copy, modify, and atomic_store() under 'lock'.
+    std::shared_ptr<const entries_t> entries;
+    boost::mutex lock;
+
+    std::atomic<uint64_t> clock, hits, misses, evictions;
+    std::atomic<size_t> capacity;
+
+    static
+    std::filesystem::file_time_type mtime(const std::string& fname)
+    {
+        std::error_code err;
+        std::filesystem::file_time_type ret(std::filesystem::last_write_time(fname, err));
+        return err ? std::filesystem::file_time_type::min() : ret;
+    }
+
+    static
+    bool current(const Entry& E)
+    {
+        for(size_t i=0; i<E.files.size(); i++) {
+            if(mtime(E.files[i].first)!=E.files[i].second)
+                return false;
+        }
+        return true;
+    }
 
-    typedef std::map<std::string, Value> cache_t;
-    cache_t cache;
+    // apply a modification to a copy of the entries.  call with 'lock' held
+    template<typename F>
+    void modify(F fn)
+    {
+        std::shared_ptr<entries_t> next(new entries_t(*std::atomic_load(&entries)));
+        fn(*next);
+        std::atomic_store(&entries, std::shared_ptr<const entries_t>(next));
+    }
 };
 
-numeric_table_cache::numeric_table_cache()
+data_file_cache::data_file_cache()
     :pvt(new Pvt)
-{}
+{
+    pvt->entries.reset(new Pvt::entries_t);
+    pvt->clock = pvt->hits = pvt->misses = pvt->evictions = 0u;
+    pvt->capacity = 1024u;
+}
 
-numeric_table_cache::~numeric_table_cache() {}
+data_file_cache::~data_file_cache() {}
 
-numeric_table_cache::table_pointer numeric_table_cache::fetch(const std::string& path)
+data_file_cache::value_pointer
+data_file_cache::fetch_any(const std::string& kind, const files_t& files, const loader_t& load)
 {
-    Pvt::Value::table_pointer ret;
+    std::string key(kind);
+    for(size_t i=0; i<files.size(); i++)
+        key += "|" + files[i];
+
+    {
+        std::shared_ptr<const Pvt::entries_t> snap(std::atomic_load(&pvt->entries));
+        Pvt::entries_t::const_iterator it = snap->find(key);
+        if(it!=snap->end() && Pvt::current(*it->second)) {
+            it->second->last_use = ++pvt->clock;
+            pvt->hits++;
+            return it->second->value;
+        }
+    }
 
-    std::filesystem::path P(path);
-    if(!P.is_absolute())
-        throw std::logic_error("numeric_table_cache want's absolute paths");
+    pvt->misses++;
 
-    auto mtime = std::filesystem::last_write_time(P);
+    // modification times from before loading, so that a change while loading causes another load later
+    std::shared_ptr<Pvt::Entry> ent(new Pvt::Entry);
+    for(size_t i=0; i<files.size(); i++)
+        ent->files.push_back(std::make_pair(files[i], Pvt::mtime(files[i])));
+
+    // concurrent misses for the same key may each load.  The last stored wins.
+    ent->value = load();
+    ent->last_use = ++pvt->clock;
 
     boost::mutex::scoped_lock L(pvt->lock);
+    pvt->modify([this, &key, &ent](Pvt::entries_t& E) {
+        E[key] = ent;
+        while(E.size()>pvt->capacity && E.size()>1u) {
+            Pvt::entries_t::iterator victim = E.end();
+            for(Pvt::entries_t::iterator it=E.begin(), end=E.end(); it!=end; ++it) {
+                if(victim==E.end() || it->second->last_use < victim->second->last_use)
+                    victim = it;
+            }
+            E.erase(victim);
+            pvt->evictions++;
+        }
+    });
 
-    Pvt::cache_t::const_iterator it = pvt->cache.find(path);
-    if(it==pvt->cache.end() || mtime>it->second.lastmod) {
-        // miss
+    return ent->value;
+}
 
-        ret.reset(new numeric_table);
+void data_file_cache::invalidate(const std::string& file)
+{
+    boost::mutex::scoped_lock L(pvt->lock);
+    pvt->modify([&file](Pvt::entries_t& E) {
+        for(Pvt::entries_t::iterator it=E.begin(); it!=E.end(); ) {
+            const Pvt::Entry::files_t& F = it->second->files;
+            bool uses = false;
+            for(size_t i=0; i<F.size() && !uses; i++)
+                uses = F[i].first==file;
+            if(uses)
+                it = E.erase(it);
+            else
+                ++it;
+        }
+    });
+}
 
-        std::ifstream strm(path.c_str());
+void data_file_cache::clear()
+{
+    boost::mutex::scoped_lock L(pvt->lock);
+    std::atomic_store(&pvt->entries, std::shared_ptr<const Pvt::entries_t>(new Pvt::entries_t));
+}
 
-        ret->read(strm);
+void data_file_cache::clear(const std::string& kind)
+{
+    const std::string prefix(kind+"|");
+    boost::mutex::scoped_lock L(pvt->lock);
+    pvt->modify([&prefix](Pvt::entries_t& E) {
+        for(Pvt::entries_t::iterator it=E.begin(); it!=E.end(); ) {
+            if(it->first.compare(0, prefix.size(), prefix)==0)
+                it = E.erase(it);
+            else
+                ++it;
+        }
+    });
+}
 
-        Pvt::Value v;
-        v.lastmod = std::filesystem::last_write_time(P); // fetch again to avoid some, but not all, races
-        v.table = ret;
+size_t data_file_cache::capacity() const
+{
+    return pvt->capacity;
+}
 
-        pvt->cache[path] = v;
-    } else {
-        ret = it->second.table;
-    }
+void data_file_cache::set_capacity(size_t cap)
+{
+    pvt->capacity = cap;
+}
 
+data_file_cache::stats_t data_file_cache::stats() const
+{
+    stats_t ret;
+    ret.size = std::atomic_load(&pvt->entries)->size();
+    ret.hits = pvt->hits;
+    ret.misses = pvt->misses;
+    ret.evictions = pvt->evictions;
     return ret;
 }
 
+data_file_cache* data_file_cache::get()
+{
+    static data_file_cache single;
+    return &single;
+}
+
+struct numeric_table_cache::Pvt {
+    boost::mutex lock;
+
+    std::string cachedir;
+
+    void load(const std::string& path, const std::string& cachedir, numeric_table& table) const
+    {
+        std::vector<char> buf;
+        if(!read_file(path, buf))
+            throw std::runtime_error(SB()<<"Unable to read '"<<path<<"'");
+        const char *raw = buf.empty() ? "" : &buf[0];
+
+        if(numeric_table::is_binary(raw, buf.size())) {
+            table.read_binary(raw, buf.size());
+            return;
+        }
+
+        std::string cfile;
+        if(!cachedir.empty()) {
+            fnv1a_hash H;
+            H.add(std::string("numeric_table"));
+            H.add(&cache_version, sizeof(cache_version));
+            H.add(raw, buf.size());
+
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.tblb", (unsigned long long)H.val);
+            cfile = (std::filesystem::path(cachedir) / name).string();
+
+            std::vector<char> cbuf;
+            if(read_file(cfile, cbuf)) {
+                try {
+                    table.read_binary(cbuf.empty() ? NULL : &cbuf[0], cbuf.size());
+                    return;
+                } catch(std::exception&) {
+                    // stale or corrupt, parse again and replace
+                }
+            }
+        }
+
+        table.read(raw, buf.size());
+
+        if(!cfile.empty()) {
+            std::ostringstream strm;
+            table.write_binary(strm);
+            store_cache_file(cfile, strm.str());
+        }
+    }
+};
+
+numeric_table_cache::numeric_table_cache()
+    :pvt(new Pvt)
+{
+    pvt->cachedir = default_cache_dir();
+}
+
+numeric_table_cache::~numeric_table_cache() {}
+
+numeric_table_cache::table_pointer numeric_table_cache::fetch(const std::string& path)
+{
+    std::filesystem::path P(path);
+    if(!P.is_absolute())
+        throw std::logic_error("numeric_table_cache want's absolute paths");
+
+    std::string cachedir;
+    {
+        boost::mutex::scoped_lock L(pvt->lock);
+        cachedir = pvt->cachedir;
+    }
+
+    return data_file_cache::get()->fetch<numeric_table>("numeric_table", data_file_cache::files_t(1, path),
+                                                        [this, &path, &cachedir]() {
+        std::shared_ptr<numeric_table> ret(new numeric_table);
+        pvt->load(path, cachedir, *ret);
+        return ret;
+    });
+}
+
 void numeric_table_cache::clear()
+{
+    data_file_cache::get()->clear("numeric_table");
+}
+
+void numeric_table_cache::setCacheDir(const std::string& dir)
 {
     boost::mutex::scoped_lock L(pvt->lock);
-    pvt->cache.clear();
+    pvt->cachedir = dir;
 }
 
  //TODO: worry about global ctor order or calls before main() ???
@@ -175,3 +488,48 @@ numeric_table_cache* numeric_table_cache::get()
 {
     return &ntc_single;
 }
+
+std::string default_cache_dir()
+{
+    const char *env = getenv("FLAME_LATTICE_CACHE");
+    return env ? env : "";
+}
+
+bool read_file(const std::string& fname, std::vector<char>& buf)
+{
+    std::ifstream strm(fname.c_str(), std::ios::binary|std::ios::ate);
+    if(!strm.is_open())
+        return false;
+    std::streamoff len = strm.tellg();
+    if(len<0)
+        return false;
+    buf.resize(len);
+    strm.seekg(0);
+    strm.read(buf.empty() ? NULL : &buf[0], buf.size());
+    return !strm.fail();
+}
+
+void store_cache_file(const std::string& fname, const std::string& contents)
+{
+    try {
+        std::filesystem::path dest(fname);
+        std::error_code err;
+        std::filesystem::create_directories(dest.parent_path(), err);
+
+        std::filesystem::path temp(dest);
+        temp += "." + boost::filesystem::unique_path().string();
+        {
+            std::ofstream strm(temp.c_str(), std::ios::binary);
+            strm.write(contents.c_str(), contents.size());
+            strm.close();
+            if(strm.fail()) {
+                std::filesystem::remove(temp, err);
+                return;
+            }
+        }
+        std::filesystem::rename(temp, dest, err);
+        if(err)
+            std::filesystem::remove(temp, err);
+    } catch(std::exception&) {
+    }
+}